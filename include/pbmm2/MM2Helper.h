@@ -69,6 +69,63 @@ struct ThreadBuffer
     mm_tbuf_t* tbuf_;
 };
 
+/// Part of a read that is mapped independently, forward read coordinates
+struct ReadWindow
+{
+    int32_t Begin;
+    int32_t End;
+};
+
+/// Primary alignment of a ReadWindow or of a stitched chain of windows.
+/// Query coordinates are forward read coordinates; Cigar uses the minimap2
+/// encoding in reference direction, without clipping.
+struct WindowHit
+{
+    bool IsMapped = false;
+    int32_t RefId = -1;
+    bool Reverse = false;
+    int32_t QueryStart = 0;
+    int32_t QueryEnd = 0;
+    int32_t RefStart = 0;
+    int32_t RefEnd = 0;
+    uint8_t MapQuality = 0;
+    std::vector<uint32_t> Cigar;
+};
+
+/// Primary or supplementary chain of a read without base-level alignment.
+/// Query coordinates are forward read coordinates; NumMatches and
+/// BlockLength are approximated from the minimizer chain.
+struct MappingHit
+{
+    int32_t RefId = -1;
+    bool Reverse = false;
+    int32_t QueryStart = 0;
+    int32_t QueryEnd = 0;
+    int32_t RefStart = 0;
+    int32_t RefEnd = 0;
+    int32_t NumMatches = 0;
+    int32_t BlockLength = 0;
+    int32_t NumMinimizers = 0;
+    int32_t ChainScore = 0;
+    uint8_t MapQuality = 0;
+};
+
+/// FASTA/FASTQ read in native orientation, aligned without building a
+/// BamRecord first. Qualities are FASTQ encoded and empty for FASTA. Header
+/// and ReadGroupId are only used once a BamRecord is built from the read.
+struct FastxRecord
+{
+    std::string Name;
+    std::string Bases;
+    std::string Qualities;
+    BAM::BamHeader Header;
+    std::string ReadGroupId;
+
+    const std::string& FullName() const { return Name; }
+    // Unaligned record with qs and qe tags
+    BAM::BamRecord ToBam() const;
+};
+
 class MM2Helper
 {
 public:
@@ -106,6 +163,35 @@ public:
                                    const std::function<bool(const AlignedRead&)>& filter,
                                    std::unique_ptr<ThreadBuffer>& tbuf) const;
 
+    // FASTA/FASTQ API, records are only built for alignments and, with
+    // MM2Settings::OutputUnmapped, for reads without alignment
+    std::vector<AlignedRecord> Align(const FastxRecord& record, const FilterFunc& filter,
+                                     std::unique_ptr<ThreadBuffer>& tbuf) const;
+
+    // Windowed BamRecord API for long UNROLLED reads, windows may be mapped
+    // in parallel. Returns no windows if the read should be aligned as a whole.
+    std::vector<ReadWindow> SplitIntoWindows(int32_t readLength) const;
+    WindowHit MapWindow(const std::string& seq, const ReadWindow& window,
+                        std::unique_ptr<ThreadBuffer>& tbuf) const;
+    // Falls back to aligning the full read if the windows are not collinear
+    std::vector<AlignedRecord> StitchWindows(const BAM::BamRecord& record,
+                                             const std::vector<ReadWindow>& windows,
+                                             const std::vector<WindowHit>& hits,
+                                             const FilterFunc& filter,
+                                             std::unique_ptr<ThreadBuffer>& tbuf) const;
+    // Same, with the native sequence that the windows were mapped with
+    std::vector<AlignedRecord> StitchWindows(const BAM::BamRecord& record, const std::string& seq,
+                                             const std::vector<ReadWindow>& windows,
+                                             const std::vector<WindowHit>& hits,
+                                             const FilterFunc& filter,
+                                             std::unique_ptr<ThreadBuffer>& tbuf) const;
+
+    // Mapping-only API, minimizer chaining without CIGAR. Requires
+    // MM2Settings::MappingOnly, otherwise the base-level alignment is
+    // computed and discarded.
+    std::vector<MappingHit> Map(const BAM::BamRecord& record,
+                                std::unique_ptr<ThreadBuffer>& tbuf) const;
+
     std::vector<PacBio::BAM::SequenceInfo> SequenceInfos() const;
 
 private:
@@ -128,6 +214,9 @@ private:
     AlignmentMode alnMode_;
     const bool trimRepeatedMatches_;
     const int32_t maxNumAlns_;
+    const int32_t windowSize_;
+    const AlignmentThresholds thresholds_;
+    const bool outputUnmapped_;
     bool enforcedMapping_ = false;
     std::vector<std::string> refNames_;
     std::unordered_map<std::string, std::vector<std::string>> readToRefsEnforcedMapping_;
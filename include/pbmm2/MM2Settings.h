@@ -9,6 +9,16 @@
 
 namespace PacBio {
 namespace minimap2 {
+/// Alignment filters that MM2Helper checks on minimap2's CIGAR, before any
+/// record is built. Zero disables a threshold.
+struct AlignmentThresholds
+{
+    int32_t MinSpan = 0;
+    double MinPercConcordance = 0;
+    double MinPercIdentity = 0;
+    double MinPercIdentityGapComp = 0;
+};
+
 struct MM2Settings
 {
     AlignmentMode AlignMode = AlignmentMode::SUBREADS;
@@ -29,11 +39,15 @@ struct MM2Settings
     int32_t MaxNumAlns = 0;
     int32_t MaxGap = -1;
     int32_t MaxSecondaryAlns = -1;
+    int32_t WindowSize = 0;
     bool NoSpliceFlank = false;
     bool DisableHPC = false;
     bool NoTrimming = false;
+    bool MappingOnly = false;
+    bool OutputUnmapped = false;
     float LongJoinFlankRatio = -1;
     std::string EnforcedMapping;
+    AlignmentThresholds Thresholds;
 };
 }  // namespace minimap2
 }  // namespace PacBio
@@ -0,0 +1,374 @@
+// Author: Armin Töpfer
+
+#include "AlignScheduler.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <stdexcept>
+
+namespace PacBio {
+namespace minimap2 {
+struct AlignScheduler::Chunk
+{
+    explicit Chunk(std::unique_ptr<std::vector<BAM::BamRecord>> records)
+        : NumRecords(records->size()), Records(std::move(records)), Results(NumRecords)
+    {}
+
+    explicit Chunk(std::unique_ptr<std::vector<FastxRecord>> reads)
+        : NumRecords(reads->size()), Fastx(std::move(reads)), Results(NumRecords)
+    {}
+
+    size_t Size() const { return NumRecords; }
+
+    // workers may still hold a chunk after it has been emitted
+    const size_t NumRecords;
+    // exactly one of both is set
+    std::unique_ptr<std::vector<BAM::BamRecord>> Records;
+    std::unique_ptr<std::vector<FastxRecord>> Fastx;
+    std::vector<std::vector<AlignedRecord>> Results;
+    // chains per read with --mapping-only, Results then hold no alignments
+    std::vector<std::vector<MappingHit>> Hits;
+
+    // guarded by AlignScheduler::mutex_
+    bool Owned = false;
+
+    std::atomic<size_t> NextRecord{0};
+    std::atomic<size_t> DoneRecords{0};
+    std::atomic<int64_t> Bases{0};
+    std::atomic<int64_t> BusyNanos{0};
+};
+
+struct AlignScheduler::WindowJob
+{
+    WindowJob(std::shared_ptr<Chunk> chunk, const size_t recordIdx, std::vector<ReadWindow> windows,
+              std::string seq)
+        : Owner(std::move(chunk))
+        , RecordIdx(recordIdx)
+        , Windows(std::move(windows))
+        , Hits(Windows.size())
+        , Sequence(std::move(seq))
+    {}
+
+    std::shared_ptr<Chunk> Owner;
+    const size_t RecordIdx;
+    // FASTX reads are encoded for stitching, see Process
+    std::unique_ptr<BAM::BamRecord> Converted;
+    const std::vector<ReadWindow> Windows;
+    std::vector<WindowHit> Hits;
+    const std::string Sequence;
+
+    std::atomic<size_t> NextWindow{0};
+    std::atomic<size_t> DoneWindows{0};
+};
+
+AlignScheduler::AlignScheduler(const MM2Helper& mm2helper, FilterFunc filter, PrepareFunc prepare,
+                               EmitFunc emit, ChunkBudget& budget, RecordPool& pool,
+                               const int32_t numThreads)
+    : AlignScheduler(mm2helper, std::move(filter), std::move(prepare), std::move(emit), nullptr,
+                     budget, pool, numThreads)
+{}
+
+AlignScheduler::AlignScheduler(const MM2Helper& mm2helper, PrepareFunc prepare, MapEmitFunc emit,
+                               ChunkBudget& budget, RecordPool& pool, const int32_t numThreads)
+    : AlignScheduler(mm2helper, nullptr, std::move(prepare), nullptr, std::move(emit), budget, pool,
+                     numThreads)
+{}
+
+AlignScheduler::AlignScheduler(const MM2Helper& mm2helper, FilterFunc filter, PrepareFunc prepare,
+                               EmitFunc emit, MapEmitFunc mapEmit, ChunkBudget& budget,
+                               RecordPool& pool, const int32_t numThreads)
+    : mm2helper_(mm2helper)
+    , filter_(std::move(filter))
+    , prepare_(std::move(prepare))
+    , emit_(std::move(emit))
+    , mapEmit_(std::move(mapEmit))
+    , budget_(budget)
+    , pool_(pool)
+    , maxInFlight_(3 * std::max(1, numThreads))
+{
+    for (int32_t i = 0; i < std::max(1, numThreads); ++i)
+        workers_.emplace_back([this]() { Work(); });
+}
+
+AlignScheduler::~AlignScheduler()
+{
+    try {
+        Finalize();
+    } catch (...) {
+    }
+}
+
+void AlignScheduler::Submit(std::unique_ptr<std::vector<BAM::BamRecord>> records)
+{
+    if (!records || records->empty()) return;
+    auto chunk = std::make_shared<Chunk>(std::move(records));
+    if (mapEmit_) chunk->Hits.resize(chunk->Size());
+    Enqueue(std::move(chunk));
+}
+
+void AlignScheduler::Submit(std::unique_ptr<std::vector<FastxRecord>> reads)
+{
+    if (!reads || reads->empty()) return;
+    if (mapEmit_) throw std::runtime_error("FASTX reads cannot be chained without records");
+    Enqueue(std::make_shared<Chunk>(std::move(reads)));
+}
+
+void AlignScheduler::Enqueue(std::shared_ptr<Chunk> chunk)
+{
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        spaceAvailable_.wait(lock, [this]() { return active_.size() < maxInFlight_ || error_; });
+        if (error_) std::rethrow_exception(error_);
+        active_.emplace_back(std::move(chunk));
+    }
+    workAvailable_.notify_one();
+}
+
+void AlignScheduler::Finalize()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        finalizing_ = true;
+    }
+    workAvailable_.notify_all();
+    for (auto& worker : workers_)
+        if (worker.joinable()) worker.join();
+    workers_.clear();
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (error_) std::rethrow_exception(error_);
+}
+
+void AlignScheduler::Work()
+{
+    // one persistent minimap2 buffer per worker, reused across chunks
+    auto tbuf = std::make_unique<ThreadBuffer>();
+    std::shared_ptr<Chunk> chunk;
+    while (true) {
+        // windows first, a split read holds back its whole chunk
+        if (numWindowJobs_ > 0) {
+            const auto job = TakeWindowJob();
+            if (job) {
+                ProcessWindow(*job, tbuf);
+                continue;
+            }
+        }
+        if (chunk) {
+            const size_t idx = chunk->NextRecord++;
+            if (idx < chunk->Size()) {
+                Process(chunk, idx, tbuf);
+                continue;
+            }
+        }
+        if (!Acquire(&chunk)) break;
+    }
+}
+
+bool AlignScheduler::Acquire(std::shared_ptr<Chunk>* chunk)
+{
+    chunk->reset();
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+        if (error_) return false;
+        if (numWindowJobs_ > 0) return true;
+        std::shared_ptr<Chunk> steal;
+        for (const auto& c : active_) {
+            if (c->NextRecord >= c->Size()) continue;
+            if (!c->Owned) {
+                c->Owned = true;
+                *chunk = c;
+                return true;
+            }
+            // earliest chunk first, it blocks in-order output
+            if (!steal) steal = c;
+        }
+        if (steal) {
+            *chunk = std::move(steal);
+            return true;
+        }
+        // stay until everything is emitted, claimed reads may still be split
+        if (finalizing_ && active_.empty()) return false;
+        workAvailable_.wait(lock);
+    }
+}
+
+std::shared_ptr<AlignScheduler::WindowJob> AlignScheduler::TakeWindowJob()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    while (!windowJobs_.empty()) {
+        const auto& job = windowJobs_.front();
+        if (job->NextWindow < job->Windows.size()) return job;
+        windowJobs_.pop_front();
+        --numWindowJobs_;
+    }
+    return nullptr;
+}
+
+void AlignScheduler::Process(const std::shared_ptr<Chunk>& chunk, const size_t idx,
+                             std::unique_ptr<ThreadBuffer>& tbuf)
+{
+    if (mapEmit_) {
+        ProcessMap(*chunk, idx, tbuf);
+        return;
+    }
+    const auto start = std::chrono::steady_clock::now();
+    std::vector<AlignedRecord> alns;
+    try {
+        BAM::BamRecord* record = nullptr;
+        const FastxRecord* read = nullptr;
+        int32_t readLength;
+        if (chunk->Fastx) {
+            read = &(*chunk->Fastx)[idx];
+            readLength = static_cast<int32_t>(read->Bases.size());
+        } else {
+            record = &(*chunk->Records)[idx];
+            if (prepare_) prepare_(*record);
+            readLength = record->Impl().SequenceLength();
+        }
+        chunk->Bases += readLength;
+        auto windows = mm2helper_.SplitIntoWindows(readLength);
+        if (windows.size() > 1) {
+            std::shared_ptr<WindowJob> job;
+            if (read) {
+                // stitching works on records, only these long reads are encoded
+                job = std::make_shared<WindowJob>(chunk, idx, std::move(windows), read->Bases);
+                job->Converted = std::make_unique<BAM::BamRecord>(read->ToBam());
+            } else {
+                job = std::make_shared<WindowJob>(chunk, idx, std::move(windows),
+                                                  record->Sequence(BAM::Orientation::NATIVE));
+            }
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                windowJobs_.emplace_back(std::move(job));
+                ++numWindowJobs_;
+            }
+            workAvailable_.notify_all();
+            chunk->BusyNanos += std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                    std::chrono::steady_clock::now() - start)
+                                    .count();
+            return;
+        }
+        alns = read ? mm2helper_.Align(*read, filter_, tbuf)
+                    : mm2helper_.Align(*record, filter_, tbuf);
+    } catch (...) {
+        SetError(std::current_exception());
+    }
+    chunk->BusyNanos += std::chrono::duration_cast<std::chrono::nanoseconds>(
+                            std::chrono::steady_clock::now() - start)
+                            .count();
+    FinishRecord(*chunk, idx, std::move(alns));
+}
+
+void AlignScheduler::ProcessMap(Chunk& chunk, const size_t idx, std::unique_ptr<ThreadBuffer>& tbuf)
+{
+    const auto start = std::chrono::steady_clock::now();
+    try {
+        auto& record = (*chunk.Records)[idx];
+        if (prepare_) prepare_(record);
+        chunk.Bases += record.Impl().SequenceLength();
+        chunk.Hits[idx] = mm2helper_.Map(record, tbuf);
+    } catch (...) {
+        SetError(std::current_exception());
+    }
+    chunk.BusyNanos += std::chrono::duration_cast<std::chrono::nanoseconds>(
+                           std::chrono::steady_clock::now() - start)
+                           .count();
+    FinishRecord(chunk, idx, {});
+}
+
+void AlignScheduler::ProcessWindow(WindowJob& job, std::unique_ptr<ThreadBuffer>& tbuf)
+{
+    const size_t w = job.NextWindow++;
+    if (w >= job.Windows.size()) return;
+
+    auto& chunk = *job.Owner;
+    const auto start = std::chrono::steady_clock::now();
+    try {
+        job.Hits[w] = mm2helper_.MapWindow(job.Sequence, job.Windows[w], tbuf);
+    } catch (...) {
+        SetError(std::current_exception());
+    }
+    if (++job.DoneWindows < job.Windows.size()) {
+        chunk.BusyNanos += std::chrono::duration_cast<std::chrono::nanoseconds>(
+                               std::chrono::steady_clock::now() - start)
+                               .count();
+        return;
+    }
+
+    std::vector<AlignedRecord> alns;
+    try {
+        const auto& record = job.Converted ? *job.Converted : (*chunk.Records)[job.RecordIdx];
+        alns = mm2helper_.StitchWindows(record, job.Sequence, job.Windows, job.Hits, filter_, tbuf);
+    } catch (...) {
+        SetError(std::current_exception());
+    }
+    chunk.BusyNanos += std::chrono::duration_cast<std::chrono::nanoseconds>(
+                           std::chrono::steady_clock::now() - start)
+                           .count();
+    FinishRecord(chunk, job.RecordIdx, std::move(alns));
+}
+
+void AlignScheduler::FinishRecord(Chunk& chunk, const size_t idx, std::vector<AlignedRecord> alns)
+{
+    chunk.Results[idx] = std::move(alns);
+
+    if (++chunk.DoneRecords == chunk.Size()) {
+        budget_.Observe(chunk.Bases, chunk.BusyNanos / 1e9);
+        EmitReady();
+    }
+}
+
+void AlignScheduler::SetError(std::exception_ptr error)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!error_) error_ = std::move(error);
+    }
+    workAvailable_.notify_all();
+    spaceAvailable_.notify_all();
+}
+
+void AlignScheduler::EmitReady()
+{
+    std::lock_guard<std::mutex> emitLock(emitMutex_);
+    while (true) {
+        std::shared_ptr<Chunk> chunk;
+        bool drained;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            // nothing is emitted after a failure, the output stays as it was
+            if (error_ || active_.empty() || active_.front()->DoneRecords < active_.front()->Size())
+                break;
+            chunk = std::move(active_.front());
+            active_.pop_front();
+            drained = finalizing_ && active_.empty();
+        }
+        spaceAvailable_.notify_one();
+        // idle workers wait for the last chunk before they exit
+        if (drained) workAvailable_.notify_all();
+
+        if (mapEmit_) {
+            try {
+                mapEmit_(*chunk->Records, chunk->Hits);
+            } catch (...) {
+                SetError(std::current_exception());
+                return;
+            }
+            pool_.Release(std::move(chunk->Records));
+            continue;
+        }
+
+        // input records are not needed for output, their storage is reused
+        pool_.Release(std::move(chunk->Records));
+        chunk->Fastx.reset();
+        try {
+            emit_(chunk->Results);
+        } catch (...) {
+            SetError(std::current_exception());
+            return;
+        }
+    }
+}
+}  // namespace minimap2
+}  // namespace PacBio
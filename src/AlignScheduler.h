@@ -0,0 +1,113 @@
+// Author: Armin Töpfer
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <pbbam/BamRecord.h>
+
+#include <pbmm2/MM2Helper.h>
+
+#include "ChunkBudget.h"
+#include "RecordPool.h"
+
+namespace PacBio {
+namespace minimap2 {
+/// Work-stealing executor for the align stage.
+///
+/// Each worker owns the chunk it took from the queue, but records are claimed
+/// one at a time. Once no unstarted chunk is left, idle workers join the
+/// earliest chunk that still has unclaimed records, so that all threads stay
+/// busy until the last read. Reads that MM2Helper splits into windows are
+/// mapped window by window by all workers, before any other work, and
+/// stitched by the worker that maps the last window. Results are emitted per
+/// chunk in input order. FASTX chunks are aligned without prior BamRecord
+/// construction and are not prepared.
+///
+/// For --mapping-only, the same protocol runs on BAM chunks whose reads are
+/// only chained, without windows and without alignment records.
+class AlignScheduler
+{
+public:
+    using PrepareFunc = std::function<void(BAM::BamRecord&)>;
+    /// Called serially and in input order with the alignments of one chunk,
+    /// one entry per read.
+    using EmitFunc = std::function<void(std::vector<std::vector<AlignedRecord>>&)>;
+    /// Called serially and in input order with the reads of one chunk and
+    /// their chains, one entry per read.
+    using MapEmitFunc = std::function<void(const std::vector<BAM::BamRecord>&,
+                                           const std::vector<std::vector<MappingHit>>&)>;
+
+public:
+    AlignScheduler(const MM2Helper& mm2helper, FilterFunc filter, PrepareFunc prepare,
+                   EmitFunc emit, ChunkBudget& budget, RecordPool& pool, int32_t numThreads);
+    /// Chains only, FASTX reads have to be submitted as records
+    AlignScheduler(const MM2Helper& mm2helper, PrepareFunc prepare, MapEmitFunc emit,
+                   ChunkBudget& budget, RecordPool& pool, int32_t numThreads);
+    ~AlignScheduler();
+
+    AlignScheduler(const AlignScheduler&) = delete;
+    AlignScheduler& operator=(const AlignScheduler&) = delete;
+
+    /// Blocks while too many chunks are in flight
+    void Submit(std::unique_ptr<std::vector<BAM::BamRecord>> records);
+    void Submit(std::unique_ptr<std::vector<FastxRecord>> reads);
+
+    /// Waits for all chunks to be emitted and rethrows the first worker error
+    void Finalize();
+
+private:
+    struct Chunk;
+    struct WindowJob;
+
+    AlignScheduler(const MM2Helper& mm2helper, FilterFunc filter, PrepareFunc prepare,
+                   EmitFunc emit, MapEmitFunc mapEmit, ChunkBudget& budget, RecordPool& pool,
+                   int32_t numThreads);
+
+    void Enqueue(std::shared_ptr<Chunk> chunk);
+    void Work();
+    bool Acquire(std::shared_ptr<Chunk>* chunk);
+    std::shared_ptr<WindowJob> TakeWindowJob();
+    void Process(const std::shared_ptr<Chunk>& chunk, size_t idx,
+                 std::unique_ptr<ThreadBuffer>& tbuf);
+    void ProcessMap(Chunk& chunk, size_t idx, std::unique_ptr<ThreadBuffer>& tbuf);
+    void ProcessWindow(WindowJob& job, std::unique_ptr<ThreadBuffer>& tbuf);
+    void FinishRecord(Chunk& chunk, size_t idx, std::vector<AlignedRecord> alns);
+    void EmitReady();
+    void SetError(std::exception_ptr error);
+
+private:
+    const MM2Helper& mm2helper_;
+    const FilterFunc filter_;
+    const PrepareFunc prepare_;
+    const EmitFunc emit_;
+    // set for --mapping-only, instead of emit_
+    const MapEmitFunc mapEmit_;
+    ChunkBudget& budget_;
+    RecordPool& pool_;
+    const size_t maxInFlight_;
+
+    std::mutex mutex_;
+    std::condition_variable workAvailable_;
+    std::condition_variable spaceAvailable_;
+    // submitted and not yet emitted, in input order
+    std::deque<std::shared_ptr<Chunk>> active_;
+    std::deque<std::shared_ptr<WindowJob>> windowJobs_;
+    std::atomic_int numWindowJobs_{0};
+    bool finalizing_ = false;
+    std::exception_ptr error_;
+
+    std::mutex emitMutex_;
+    std::vector<std::thread> workers_;
+};
+}  // namespace minimap2
+}  // namespace PacBio
@@ -8,6 +8,7 @@
 #include <iterator>
 #include <map>
 #include <sstream>
+#include <stdexcept>
 #include <string>
 #include <vector>
 
@@ -105,11 +106,89 @@ R"({
 const CLI_v2::Option ChunkSize{
 R"({
     "names" : ["chunk-size"],
-    "description" : "Process N records per chunk.",
+    "description" : "Process at most N records per chunk.",
     "type" : "int",
     "default" : 100
 })"};
 
+const CLI_v2::Option ChunkBases{
+R"({
+    "names" : ["chunk-bases"],
+    "description" : [
+        "Process at most N bases per chunk; suffixes M and G allowed.",
+        " With 0, the budget is tuned at runtime from observed chunk latency."
+    ],
+    "type" : "string",
+    "default" : "0"
+})"};
+
+const CLI_v2::Option MaxOpenFiles{
+R"({
+    "names" : ["max-open-files"],
+    "description" : [
+        "Read at most N input BAM files of a FOFN or dataset concurrently,",
+        " records are still processed in input order."
+    ],
+    "type" : "int",
+    "default" : 8
+})"};
+
+const CLI_v2::Option Follow{
+R"({
+    "names" : ["follow"],
+    "description" : [
+        "Align an input BAM file that is still being written. Waits for new BGZF blocks until",
+        " the EOF marker is written or the file <input>.done exists."
+    ]
+})"};
+
+const CLI_v2::Option CheckpointInterval{
+R"({
+    "names" : ["checkpoint-interval"],
+    "description" : [
+        "Save progress every N minutes in <out prefix>.pbmm2.checkpoint, such that an interrupted",
+        " run can be continued with --resume. 0 disables."
+    ],
+    "type" : "int",
+    "default" : 0
+})"};
+
+const CLI_v2::Option Resume{
+R"({
+    "names" : ["resume"],
+    "description" : [
+        "Continue an interrupted run from its last checkpoint. Input, reference, and options",
+        " have to be the same."
+    ]
+})"};
+
+const CLI_v2::Option CheckpointChunks{
+R"({
+    "names" : ["checkpoint-chunks"],
+    "description" : "Save progress every N emitted chunks instead of every N minutes. 0 disables.",
+    "type" : "int",
+    "default" : 0,
+    "hidden" : true
+})"};
+
+const CLI_v2::Option StopAfterCheckpoint{
+R"({
+    "names" : ["stop-after-checkpoint"],
+    "description" : "Abort right after the first checkpoint, as if the run was killed.",
+    "hidden" : true
+})"};
+
+const CLI_v2::Option WindowSize{
+R"({
+    "names" : ["window-size"],
+    "description" : [
+        "Align UNROLLED reads of at least 2N bases in parallel, in overlapping windows of at most",
+        " N bases that are stitched into one alignment. 0 disables."
+    ],
+    "type" : "int",
+    "default" : 0
+})"};
+
 const CLI_v2::Option AlignKmer{
 R"({
     "names" : ["k"],
@@ -220,6 +299,94 @@ R"({
     "description" : "Do not prefer splice flanks GT-AG (effective in ISOSEQ preset)."
 })"};
 
+const CLI_v2::Option MinReadLength{
+R"({
+    "names" : ["min-read-length"],
+    "description" : "Skip input reads shorter than N bases.",
+    "type" : "int",
+    "default" : 0
+})"};
+
+const CLI_v2::Option MaxReadLength{
+R"({
+    "names" : ["max-read-length"],
+    "description" : "Skip input reads longer than N bases. 0 disables.",
+    "type" : "int",
+    "default" : 0
+})"};
+
+const CLI_v2::Option MinReadQuality{
+R"({
+    "names" : ["min-rq"],
+    "description" : "Skip input reads with a predicted read quality (rq) below this value.",
+    "type" : "double",
+    "default" : 0
+})"};
+
+const CLI_v2::Option IncludeZmws{
+R"({
+    "names" : ["include-zmws"],
+    "description" : "Only align reads of the hole numbers listed in this file, one per line.",
+    "type" : "string"
+})"};
+
+const CLI_v2::Option IncludeNames{
+R"({
+    "names" : ["include-names"],
+    "description" : "Only align reads with the names listed in this file, one per line.",
+    "type" : "string"
+})"};
+
+const CLI_v2::Option IncludeMovies{
+R"({
+    "names" : ["include-movies"],
+    "description" : "Only align reads of these movies, comma-separated.",
+    "type" : "string"
+})"};
+
+const CLI_v2::Option Subsample{
+R"({
+    "names" : ["subsample"],
+    "description" : [
+        "Align this fraction of ZMWs, selected by a hash of movie name and hole number, or of",
+        " the read name without hole number. Deterministic across runs."
+    ],
+    "type" : "double",
+    "default" : 1
+})"};
+
+const CLI_v2::Option MaxReads{
+R"({
+    "names" : ["max-reads"],
+    "description" : [
+        "Stop after N input reads. With .pbi files, reads are subsampled across the whole",
+        " input. 0 disables."
+    ],
+    "type" : "int",
+    "default" : 0
+})"};
+
+const CLI_v2::Option Shard{
+R"({
+    "names" : ["shard"],
+    "description" : [
+        "Align shard i of N disjoint parts of the input, given as i/N with 1 <= i <= N.",
+        " Reads of a ZMW stay in one shard."
+    ],
+    "type" : "string"
+})"};
+
+const CLI_v2::Option MaxCoverage{
+R"({
+    "names" : ["max-coverage"],
+    "description" : [
+        "Omit alignments in reference bins of 10 kb that are covered N-fold and stop once 99%",
+        " of all bins are covered N-fold. 0 disables."
+    ],
+    "type" : "double",
+    "default" : 0
+})"};
+
 const CLI_v2::Option MedianFilter{
 R"({
     "names" : ["median-filter"],
@@ -341,6 +508,12 @@ R"({
     "description" : "Include unmapped records in output."
 })"};
 
+const CLI_v2::Option MappingOnly{
+R"({
+    "names" : ["mapping-only"],
+    "description" : "Skip base-level alignment. Output minimizer chains with approximate coordinates and MAPQ as PAF."
+})"};
+
 const CLI_v2::Option MaxNumAlns{
 R"({
     "names" : ["N", "best-n"],
@@ -389,6 +562,15 @@ R"({
     "hidden" : true
 })"};
 
+const CLI_v2::Option PerfCounters{
+R"({
+    "names" : ["perf-counters"],
+    "description" : [
+        "Sample hardware performance counters per pipeline stage (Linux only) ",
+        "and report them with the alignment metrics."
+    ]
+})"};
+
 const CLI_v2::PositionalArgument Reference {
 R"({
     "name" : "ref.fa|xml|mmi",
@@ -420,7 +602,21 @@ AlignSettings::AlignSettings(const PacBio::CLI_v2::Results& options)
     , MinAlignmentLength(options[OptionNames::MinAlignmentLength])
     , SampleName(options[OptionNames::SampleName])
     , ChunkSize(options[OptionNames::ChunkSize])
+    , MaxOpenFiles(options[OptionNames::MaxOpenFiles])
+    , Follow(options[OptionNames::Follow])
+    , CheckpointInterval(options[OptionNames::CheckpointInterval])
+    , Resume(options[OptionNames::Resume])
+    , CheckpointChunks(options[OptionNames::CheckpointChunks])
+    , StopAfterCheckpoint(options[OptionNames::StopAfterCheckpoint])
     , MedianFilter(options[OptionNames::MedianFilter])
+    , MinReadLength(options[OptionNames::MinReadLength])
+    , MaxReadLength(options[OptionNames::MaxReadLength])
+    , MinReadQuality(options[OptionNames::MinReadQuality])
+    , IncludeZmwsFile(options[OptionNames::IncludeZmws])
+    , IncludeNamesFile(options[OptionNames::IncludeNames])
+    , Subsample(options[OptionNames::Subsample])
+    , MaxReads(options[OptionNames::MaxReads])
+    , MaxCoverage(options[OptionNames::MaxCoverage])
     , Sort(options[OptionNames::Sort])
     , ZMW(options[OptionNames::ZMW])
     , HQRegion(options[OptionNames::HQRegion])
@@ -428,9 +624,49 @@ AlignSettings::AlignSettings(const PacBio::CLI_v2::Results& options)
     , SplitBySample(options[OptionNames::SplitBySample])
     , Rg(options[OptionNames::Rg])
     , CreatePbi(options[OptionNames::CreatePbi])
-    , OutputUnmapped(options[OptionNames::OutputUnmapped])
     , CompressSequenceHomopolymers(options[OptionNames::CompressSequenceHomopolymers])
+    , PerfCounters(options[OptionNames::PerfCounters])
 {
+    const std::string requestedChunkBases = options[OptionNames::ChunkBases];
+    ChunkBases = SizeStringToIntMG(requestedChunkBases);
+    if (ChunkBases < 0) throw AbortException("Option --chunk-bases must not be negative.");
+    if (ChunkSize < 1) throw AbortException("Option --chunk-size must be at least 1.");
+    if (MaxOpenFiles < 1) throw AbortException("Option --max-open-files must be at least 1.");
+    if (CheckpointInterval < 0)
+        throw AbortException("Option --checkpoint-interval must not be negative.");
+    if (CheckpointChunks < 0)
+        throw AbortException("Option --checkpoint-chunks must not be negative.");
+
+    if (MinReadLength < 0 || MaxReadLength < 0)
+        throw AbortException("Options --min-read-length and --max-read-length must be positive.");
+    if (MaxReadLength > 0 && MaxReadLength < MinReadLength)
+        throw AbortException("Option --max-read-length must not be below --min-read-length.");
+    if (MinReadQuality < 0 || MinReadQuality > 1)
+        throw AbortException("Option --min-rq has to be between 0 and 1.");
+    if (Subsample <= 0 || Subsample > 1)
+        throw AbortException("Option --subsample has to be larger than 0 and at most 1.");
+    if (MaxReads < 0) throw AbortException("Option --max-reads must not be negative.");
+    if (MaxCoverage < 0) throw AbortException("Option --max-coverage must not be negative.");
+    const std::string shard = options[OptionNames::Shard];
+    if (!shard.empty()) {
+        const auto slash = shard.find('/');
+        try {
+            if (slash == std::string::npos) throw std::invalid_argument(shard);
+            size_t indexEnd = 0;
+            size_t numEnd = 0;
+            ShardIndex = std::stoi(shard.substr(0, slash), &indexEnd) - 1;
+            NumShards = std::stoi(shard.substr(slash + 1), &numEnd);
+            if (indexEnd != slash || numEnd != shard.size() - slash - 1)
+                throw std::invalid_argument(shard);
+        } catch (const std::exception&) {
+            NumShards = 0;
+        }
+        if (NumShards < 1 || ShardIndex < 0 || ShardIndex >= NumShards)
+            throw AbortException("Option --shard must be of the form i/N with 1 <= i <= N.");
+    }
+    const std::string movies = options[OptionNames::IncludeMovies];
+    if (!movies.empty()) boost::split(IncludeMovies, movies, boost::is_any_of(","));
+
     MM2Settings::Kmer = options[OptionNames::AlignKmer];
     MM2Settings::MinimizerWindowSize = options[OptionNames::AlignMinimizerWindowSize];
     MM2Settings::GapOpen1 = options[OptionNames::GapOpen1];
@@ -453,6 +689,15 @@ AlignSettings::AlignSettings(const PacBio::CLI_v2::Results& options)
     MM2Settings::EnforcedMapping = std::string(options[OptionNames::EnforcedMapping]);
     if (!MM2Settings::EnforcedMapping.empty()) MM2Settings::NoTrimming = true;
     MM2Settings::MaxSecondaryAlns = options[OptionNames::MaxSecondaryAlns];
+    MM2Settings::MappingOnly = options[OptionNames::MappingOnly];
+    MM2Settings::OutputUnmapped = options[OptionNames::OutputUnmapped];
+    MM2Settings::Thresholds = {MinAlignmentLength, MinPercConcordance, MinPercIdentity,
+                               MinPercIdentityGapComp};
+    if (MM2Settings::MappingOnly && (Sort || SplitBySample || CreatePbi))
+        throw AbortException(
+            "Option --mapping-only cannot be combined with --sort, --split-by-sample, or --pbi.");
+    if (MM2Settings::MappingOnly && !MM2Settings::EnforcedMapping.empty())
+        throw AbortException("Option --mapping-only does not support enforced mapping.");
 
     const bool noBai = options[OptionNames::NoBAI];
     const std::string bamIdx = options[OptionNames::BamIndexInput];
@@ -573,13 +818,16 @@ AlignSettings::AlignSettings(const PacBio::CLI_v2::Results& options)
         throw AbortException(
             "Options --zmw, --hqregion and --median-filter are mutually exclusive.");
     }
-    if (ZMW || HQRegion) {
-        if (ChunkSize != 100)
-            PBLOG_WARN << "Cannot change --chunk-size in --zmw/--hqregion mode. Parameters "
-                          "--chunk-size is forced to 1.";
-        ChunkSize = 1;
-        MM2Settings::AlignMode = AlignmentMode::UNROLLED;
-    }
+    // ZMW reads are batched like any other record, chunks are bounded by --chunk-bases
+    if (ZMW || HQRegion) MM2Settings::AlignMode = AlignmentMode::UNROLLED;
+
+    MM2Settings::WindowSize = options[OptionNames::WindowSize];
+    if (MM2Settings::WindowSize < 0 ||
+        (MM2Settings::WindowSize > 0 && MM2Settings::WindowSize < 1000))
+        throw AbortException("Option --window-size must be 0 or at least 1000.");
+    if (MM2Settings::WindowSize > 0 && MM2Settings::AlignMode != AlignmentMode::UNROLLED)
+        PBLOG_WARN << "Option --window-size is only used with --preset UNROLLED, --zmw, or "
+                      "--hqregion!";
 
     if (!Rg.empty() && !boost::contains(Rg, "ID") && !boost::starts_with(Rg, "@RG\t")) {
         throw AbortException(
@@ -638,13 +886,21 @@ PacBio::CLI_v2::Interface AlignSettings::CreateCLI()
 
     i.AddOptionGroup("Basic Options", {
         OptionNames::ChunkSize,
+        OptionNames::ChunkBases,
+        OptionNames::MaxOpenFiles,
+        OptionNames::Follow,
+        OptionNames::CheckpointInterval,
+        OptionNames::Resume,
         OptionNames::NoTrimming,
+        OptionNames::PerfCounters,
 
         // hidden
         OptionNames::SortMemoryTC,
         OptionNames::CreatePbi,
         OptionNames::EnforcedMapping,
         OptionNames::MaxSecondaryAlns,
+        OptionNames::CheckpointChunks,
+        OptionNames::StopAfterCheckpoint,
     });
 
     i.AddOptionGroup("Sorting Options", {
@@ -701,16 +957,37 @@ PacBio::CLI_v2::Interface AlignSettings::CreateCLI()
         OptionNames::Strip,
         OptionNames::SplitBySample,
         OptionNames::OutputUnmapped,
+        OptionNames::MappingOnly,
         OptionNames::BamIndexInput,
         OptionNames::NoBAI,
     });
 
+    i.AddOptionGroup("Input Filter Options (combined with AND)", {
+        OptionNames::MinReadLength,
+        OptionNames::MaxReadLength,
+        OptionNames::MinReadQuality,
+        OptionNames::IncludeZmws,
+        OptionNames::IncludeNames,
+        OptionNames::IncludeMovies,
+    });
+
+    i.AddOptionGroup("Subsampling Options", {
+        OptionNames::Subsample,
+        OptionNames::MaxReads,
+        OptionNames::MaxCoverage,
+        OptionNames::Shard,
+    });
+
     i.AddOptionGroup("Input Manipulation Options (mutually exclusive)", {
         OptionNames::MedianFilter,
         OptionNames::ZMW,
         OptionNames::HQRegion,
     });
 
+    i.AddOptionGroup("Unrolled Alignment Options", {
+        OptionNames::WindowSize,
+    });
+
     i.AddOptionGroup("Sequence Manipulation Options", {
         OptionNames::CompressSequenceHomopolymers
     });
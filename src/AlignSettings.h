@@ -27,9 +27,33 @@ struct AlignSettings : MM2Settings
 
     const std::string SampleName;
     int32_t ChunkSize;
+    int64_t ChunkBases = 0;
+    int32_t MaxOpenFiles;
+    bool Follow;
+    // minutes between checkpoints, 0 disables
+    int32_t CheckpointInterval;
+    bool Resume;
+    // emitted chunks between checkpoints, takes precedence over minutes
+    int32_t CheckpointChunks;
+    bool StopAfterCheckpoint;
 
     bool MedianFilter;
 
+    // input read filters
+    int32_t MinReadLength;
+    int32_t MaxReadLength;
+    double MinReadQuality;
+    const std::string IncludeZmwsFile;
+    const std::string IncludeNamesFile;
+    std::vector<std::string> IncludeMovies;
+
+    double Subsample;
+    int32_t MaxReads;
+    double MaxCoverage;
+    // zero-based index of the input shard to align
+    int32_t ShardIndex = 0;
+    int32_t NumShards = 1;
+
     bool Sort;
     int SortThreads;
     int64_t SortMemory;
@@ -44,10 +68,11 @@ struct AlignSettings : MM2Settings
 
     bool CreatePbi;
     BamIndex BamIdx = BamIndex::NONE;
-    bool OutputUnmapped;
 
     bool CompressSequenceHomopolymers;
 
+    bool PerfCounters;
+
     /// Parses the provided CLI::Results and retrieves a defined set of options.
     AlignSettings(const PacBio::CLI_v2::Results& options);
 
@@ -6,21 +6,22 @@
 
 #include <cstdio>
 
-#include <atomic>
+#include <algorithm>
+#include <array>
 #include <chrono>
+#include <deque>
+#include <fstream>
 #include <functional>
 #include <iostream>
 #include <mutex>
+#include <set>
 #include <sstream>
-#include <thread>
-#include <tuple>
 #include <vector>
 
 #include <pbbam/BamWriter.h>
 #include <pbbam/DataSet.h>
 #include <pbbam/EntireFileQuery.h>
 #include <pbbam/FastaReader.h>
-#include <pbbam/FastqReader.h>
 #include <pbbam/PbiFilter.h>
 #include <pbbam/PbiFilterQuery.h>
 #include <pbbam/virtual/ZmwReadStitcher.h>
@@ -28,7 +29,6 @@
 #include <pbcopper/data/LocalContextFlags.h>
 #include <pbcopper/json/JSON.h>
 #include <pbcopper/logging/Logging.h>
-#include <pbcopper/parallel/FireAndForget.h>
 #include <pbcopper/utility/FileUtils.h>
 
 #include <pbmm2/MM2Helper.h>
@@ -36,12 +36,25 @@
 #include <mmpriv.h>
 
 #include "AbortException.h"
+#include "AlignScheduler.h"
 #include "AlignSettings.h"
 #include "BamIndex.h"
+#include "Checkpoint.h"
+#include "ChunkBudget.h"
+#include "CoverageCap.h"
+#include "FastxReader.h"
+#include "InputCatalog.h"
+#include "InputFilter.h"
 #include "InputOutputUX.h"
+#include "MedianFilter.h"
+#include "OrderedParallelReader.h"
+#include "PerfCounters.h"
+#include "RecordPool.h"
 #include "SampleNames.h"
+#include "StreamInput.h"
 #include "StreamWriters.h"
 #include "Timer.h"
+#include "ZmwStitcher.h"
 #include "bam_sort.h"
 
 namespace PacBio {
@@ -71,6 +84,10 @@ int AlignWorkflow::Runner(const CLI_v2::Results& options)
         throw AbortException("Cannot combine --collapse-homopolymers with MMI input.");
     }
 
+    if (uio.isFromStream && settings.MedianFilter) {
+        throw AbortException("Cannot combine --median-filter with input from stdin or a pipe.");
+    }
+
     if (uio.isFromFofn && settings.SplitBySample) {
         throw AbortException("Cannot combine --split-by-sample with fofn input.");
     }
@@ -79,6 +96,38 @@ int AlignWorkflow::Runner(const CLI_v2::Results& options)
         throw AbortException("Cannot override read groups with BAM input. Remove option --rg.");
     }
 
+    if (settings.MappingOnly) {
+        if (uio.isToXML || uio.isToJson)
+            throw AbortException(
+                "Option --mapping-only writes PAF, output cannot be a dataset or JSON!");
+        if (settings.MinPercConcordance > 0 || settings.MinPercIdentity > 0 ||
+            settings.MinPercIdentityGapComp > 0)
+            PBLOG_WARN << "Identity filters are ignored with --mapping-only!";
+    }
+
+    const bool checkpoints =
+        settings.CheckpointInterval > 0 || settings.CheckpointChunks > 0 || settings.Resume;
+    if (checkpoints) {
+        if (uio.outPrefix == "-")
+            throw AbortException(
+                "Options --checkpoint-interval and --resume require an output file.");
+        if (uio.isFromStream)
+            throw AbortException(
+                "Cannot combine --checkpoint-interval or --resume with input from stdin, a pipe, "
+                "or --follow.");
+        if (settings.MappingOnly)
+            throw AbortException(
+                "Cannot combine --checkpoint-interval or --resume with --mapping-only.");
+        if (settings.MaxCoverage > 0)
+            throw AbortException(
+                "Cannot combine --checkpoint-interval or --resume with --max-coverage.");
+    }
+
+    if (settings.PerfCounters && !PerfCounters::Enable()) {
+        PBLOG_WARN << "Hardware performance counters are not available on this host. Option "
+                      "--perf-counters is ignored!";
+    }
+
     const FilterFunc filter = [&settings](const AlignedRecord& aln) {
         if (aln.Span <= 0 || aln.Span < settings.MinAlignmentLength) return false;
         if (settings.MinPercIdentity <= 0 && settings.MinPercIdentityGapComp <= 0 &&
@@ -117,10 +166,37 @@ int AlignWorkflow::Runner(const CLI_v2::Results& options)
 
     Summary s;
     int64_t alignedReads = 0;
-
-    const auto BamQueryFile = [](const std::string& file) {
+    int64_t sumMapQuality = 0;
+
+    InputFilter inputFilter(settings);
+    if (settings.NumShards > 1 && !uio.isFromStream) {
+        // subreads of a ZMW have to stay in one shard
+        inputFilter.PlanShards(
+            uio.isFromJson ? std::vector<std::string>{uio.unpackedFromJson} : uio.inputFiles,
+            uio.isFromSubreadset || settings.MedianFilter || settings.ZMW || settings.HQRegion,
+            uio.isFastaInput || uio.isFastqInput);
+    }
+    // the cap applies to the reads of this shard that pass all filters
+    if (settings.MaxReads > 0 && !uio.isFastaInput && !uio.isFastqInput && !uio.isFromStream &&
+        !settings.MedianFilter && !settings.ZMW && !settings.HQRegion) {
+        inputFilter.SpreadReadCap(
+            settings.MaxReads,
+            uio.isFromJson ? std::vector<std::string>{uio.unpackedFromJson} : uio.inputFiles);
+    }
+    if ((settings.ZMW || settings.HQRegion) &&
+        (settings.MinReadQuality > 0 || !settings.IncludeNamesFile.empty()))
+        PBLOG_WARN << "Options --min-rq and --include-names are ignored with --zmw and --hqregion!";
+    if (inputFilter.UsesPacBioFields() && (uio.isFastaInput || uio.isFastqInput))
+        PBLOG_WARN << "Options --min-rq, --include-zmws, and --include-movies are ignored with "
+                      "FASTA/FASTQ input!";
+
+    // Input filters are pushed into the PBI query if possible, otherwise
+    // filterRecords is set and records have to be tested after decoding.
+    const auto BamQueryFile = [&inputFilter](const std::string& file, bool* filterRecords) {
         try {
-            const auto filter = BAM::PbiFilter::FromDataSet(file);
+            *filterRecords = !inputFilter.IsEmpty() && !InputFilter::HasPbi(file);
+            const auto filter = *filterRecords ? BAM::PbiFilter::FromDataSet(file)
+                                               : inputFilter.CombinedPbiFilter(file);
             std::unique_ptr<BAM::internal::IQuery> query(nullptr);
             if (filter.IsEmpty())
                 query = std::make_unique<BAM::EntireFileQuery>(file);
@@ -132,13 +208,58 @@ int AlignWorkflow::Runner(const CLI_v2::Results& options)
         }
     };
 
+    // One reader task per BAM file of every input, sharing the query of the
+    // input it belongs to. Supplementary alignments are skipped for aligned input.
+    const auto BamFileTasks = [&inputFilter, &uio](const std::vector<std::string>& files,
+                                                   const bool alignedInput) {
+        std::vector<OrderedParallelReader::Task> tasks;
+        for (const auto& file : files) {
+            bool filterRecords;
+            BAM::PbiFilter filter;
+            std::vector<std::string> bamFiles;
+            try {
+                filterRecords = !inputFilter.IsEmpty() && !InputFilter::HasPbi(file);
+                filter = filterRecords ? BAM::PbiFilter::FromDataSet(uio.catalog->DataSet(file))
+                                       : inputFilter.CombinedPbiFilter(file);
+                bamFiles = uio.catalog->BamFiles(file);
+            } catch (...) {
+                throw AbortException(UNKNOWN_FILE_TYPES);
+            }
+            for (const auto& bamFile : bamFiles) {
+                tasks.emplace_back([&inputFilter, filter, filterRecords, bamFile,
+                                    alignedInput](const OrderedParallelReader::EmitFunc& emit) {
+                    std::unique_ptr<BAM::internal::IQuery> query(nullptr);
+                    if (filter.IsEmpty())
+                        query = std::make_unique<BAM::EntireFileQuery>(bamFile);
+                    else
+                        query = std::make_unique<BAM::PbiFilterQuery>(filter, bamFile);
+                    BAM::BamRecord record;
+                    while (query->GetNext(record)) {
+                        if (alignedInput && record.Impl().IsSupplementaryAlignment()) continue;
+                        if (filterRecords && !inputFilter.Accepts(record)) continue;
+                        emit(std::move(record));
+                        record = BAM::BamRecord();
+                    }
+                });
+            }
+        }
+        return tasks;
+    };
+
     std::unique_ptr<StreamWriters> writers;
+    std::unique_ptr<Checkpoint> checkpoint;
     {
         static const std::string fallbackSampleName{"UnnamedSample"};
 
         MovieToSampleToInfix mtsti;
-        if (!uio.isFastaInput && !uio.isFastqInput)
+        if (!uio.isFastaInput && !uio.isFastqInput && !uio.isFromStream) {
+            Timer catalogTime;
+            uio.catalog->LoadHeaders(
+                uio.isFromJson ? std::vector<std::string>{uio.unpackedFromJson} : uio.inputFiles,
+                settings.NumThreads);
+            PBLOG_TRACE << "Read input headers in " << catalogTime.ElapsedTime();
             mtsti = SampleNames::DetermineMovieToSampleToInfix(uio);
+        }
 
         std::map<std::string, std::set<std::string>> infixToSamples;
         for (const auto& movie_sampleInfix : mtsti)
@@ -165,54 +286,130 @@ int AlignWorkflow::Runner(const CLI_v2::Results& options)
         for (const auto& si : mm2helper->SequenceInfos())
             hdr.AddSequence(si);
 
-        PacBio::Parallel::FireAndForget faf(settings.NumThreads, 3);
+        // --mapping-only does not encode BAM, chains are written as PAF
+        std::ofstream pafFile;
+        if (!settings.MappingOnly)
+            writers = std::make_unique<StreamWriters>(
+                hdr, uio.outPrefix, settings.SplitBySample, settings.Sort, settings.BamIdx,
+                settings.SortThreads, settings.NumThreads, settings.SortMemory);
+        else if (uio.outFile != "-") {
+            pafFile.open(uio.outFile);
+            if (!pafFile) throw AbortException("Could not open output file " + uio.outFile);
+        }
+        std::ostream& paf = pafFile.is_open() ? pafFile : std::cout;
+
+        // input reads whose alignments are in the output fragments of the last checkpoint
+        int64_t skipInputReads = 0;
+        if (checkpoints) {
+            // one labelled line per option that changes which reads are skipped
+            // or how the alignments of the remaining ones look
+            std::ostringstream signature;
+            const auto Sign = [&signature](const char* key, const auto& value) {
+                signature << key << '=' << value << '\n';
+            };
+            for (const auto& f :
+                 uio.isFromJson ? std::vector<std::string>{uio.unpackedFromJson} : uio.inputFiles)
+                Sign("input", f);
+            Sign("reference", uio.refFile);
+            Sign("output", uio.outFile);
+            Sign("sort", settings.Sort);
+            Sign("split-by-sample", settings.SplitBySample);
+            Sign("sample", settings.SampleName);
+            Sign("rg", settings.Rg);
+            Sign("strip", settings.Strip);
+            Sign("unmapped", settings.OutputUnmapped);
+            Sign("shard", std::to_string(settings.ShardIndex + 1) + '/' +
+                              std::to_string(settings.NumShards));
+            Sign("max-reads", settings.MaxReads);
+            Sign("subsample", settings.Subsample);
+            Sign("min-read-length", settings.MinReadLength);
+            Sign("max-read-length", settings.MaxReadLength);
+            Sign("min-rq", settings.MinReadQuality);
+            Sign("include-zmws", settings.IncludeZmwsFile);
+            Sign("include-names", settings.IncludeNamesFile);
+            for (const auto& movie : settings.IncludeMovies)
+                Sign("include-movies", movie);
+            Sign("median-filter", settings.MedianFilter);
+            Sign("zmw", settings.ZMW);
+            Sign("hqregion", settings.HQRegion);
+            Sign("collapse-homopolymers", settings.CompressSequenceHomopolymers);
+            // presets are resolved into the parameters below
+            Sign("preset", static_cast<int>(settings.AlignMode));
+            Sign("k", settings.Kmer);
+            Sign("w", settings.MinimizerWindowSize);
+            Sign("no-kmer-compression", settings.DisableHPC);
+            Sign("gap-open-1", settings.GapOpen1);
+            Sign("gap-open-2", settings.GapOpen2);
+            Sign("gap-extend-1", settings.GapExtension1);
+            Sign("gap-extend-2", settings.GapExtension2);
+            Sign("A", settings.MatchScore);
+            Sign("B", settings.MismatchPenalty);
+            Sign("z", settings.Zdrop);
+            Sign("Z", settings.ZdropInv);
+            Sign("r", settings.Bandwidth);
+            Sign("G", settings.MaxIntronLength);
+            Sign("C", settings.NonCanon);
+            Sign("g", settings.MaxGap);
+            Sign("no-splice-flank", settings.NoSpliceFlank);
+            Sign("lj-min-ratio", settings.LongJoinFlankRatio);
+            Sign("no-rmt", settings.NoTrimming);
+            Sign("window-size", settings.WindowSize);
+            Sign("enforced-mapping", settings.EnforcedMapping);
+            Sign("best-n", settings.MaxNumAlns);
+            Sign("max-secondary-alns", settings.MaxSecondaryAlns);
+            Sign("min-concordance-perc", settings.MinPercConcordance);
+            Sign("min-id-perc", settings.MinPercIdentity);
+            Sign("min-gap-comp-id-perc", settings.MinPercIdentityGapComp);
+            Sign("min-length", settings.MinAlignmentLength);
+            checkpoint = std::make_unique<Checkpoint>(uio.outPrefix, settings.CheckpointInterval,
+                                                      settings.CheckpointChunks, settings.Resume,
+                                                      signature.str());
+            const auto& resumed = checkpoint->Resumed();
+            writers->UseFragments(checkpoint->Directory(), resumed.Fragments);
+            s = resumed.Stats;
+            alignedReads = resumed.AlignedReads;
+            skipInputReads = resumed.NumInputReads;
+        }
+        int64_t emittedInputReads = skipInputReads;
+        // input reads of each submitted and not yet emitted chunk
+        std::mutex chunkSizesMutex;
+        std::deque<int64_t> chunkSizes;
 
-        writers = std::make_unique<StreamWriters>(
-            hdr, uio.outPrefix, settings.SplitBySample, settings.Sort, settings.BamIdx,
-            settings.SortThreads, settings.NumThreads, settings.SortMemory);
+        ChunkBudget budget(settings.ChunkBases, settings.ChunkSize);
 
-        int32_t i = 0;
-        const int32_t chunkSize = settings.ChunkSize;
-        auto records = std::make_unique<std::vector<BAM::BamRecord>>(chunkSize);
+        std::unique_ptr<CoverageCap> coverageCap;
+        if (settings.MaxCoverage > 0)
+            coverageCap =
+                std::make_unique<CoverageCap>(mm2helper->SequenceInfos(), settings.MaxCoverage);
 
-        std::mutex outputMutex;
         int64_t alignedRecords = 0;
-        std::atomic_int waiting{0};
         const auto firstTime = std::chrono::steady_clock::now();
         auto lastTime = std::chrono::steady_clock::now();
-        auto Submit = [&](const std::unique_ptr<std::vector<BAM::BamRecord>>& recs) {
-            const auto Strip = [](BAM::BamRecord& record) {
-                auto& impl = record.Impl();
-                for (const auto& t : {"dq", "dt", "ip", "iq", "mq", "pa", "pc", "pd", "pe", "pg",
-                                      "pm", "pq", "pt", "pv", "pw", "px", "sf", "sq", "st"})
-                    impl.RemoveTag(t);
-            };
-            if (settings.Strip) {
-                for (auto& r : *recs)
-                    Strip(r);
-            }
+        // Kinetic and extra QV tags are stripped while reading, see AddRecord
+        const auto Prepare = [&](BAM::BamRecord& record) {
             if (settings.CompressSequenceHomopolymers) {
-                const auto Compress = [&](BAM::BamRecord& record) {
-                    std::string newSeq = CompressHomopolymers(record.Sequence());
-                    record.Impl().SetSequenceAndQualities(newSeq);
-                    if (record.HasQueryStart() && record.HasQueryEnd()) {
-                        record.Impl().EditTag(
-                            "qe", record.QueryStart() + static_cast<int32_t>(newSeq.size()));
-                    }
-                };
-                for (auto& r : *recs) {
-                    Compress(r);
-                    Strip(r);
+                std::string newSeq = CompressHomopolymers(record.Sequence());
+                record.Impl().SetSequenceAndQualities(newSeq);
+                if (record.HasQueryStart() && record.HasQueryEnd()) {
+                    record.Impl().EditTag(
+                        "qe", record.QueryStart() + static_cast<int32_t>(newSeq.size()));
                 }
             }
-            int32_t aligned = 0;
-            try {
-                auto output = mm2helper->Align(recs, filter, &aligned);
-                if (output) {
-                    std::lock_guard<std::mutex> lock(outputMutex);
-                    alignedReads += aligned;
-                    for (auto& aln : *output) {
+        };
+        // called serially, in input order
+        const auto Emit = [&](std::vector<std::vector<AlignedRecord>>& results) {
+            {
+                // counted once per chunk, not per record
+                const PerfScope perf{PerfStage::WRITE};
+                for (auto& output : results) {
+                    // a read counts as mapped once one of its alignments is written
+                    bool written = false;
+                    for (auto& aln : output) {
                         if (!settings.OutputUnmapped && !aln.IsAligned) continue;
+                        if (aln.IsAligned && coverageCap &&
+                            !coverageCap->Add(aln.Record.ReferenceId(), aln.Record.ReferenceStart(),
+                                              aln.Record.ReferenceEnd()))
+                            continue;
                         if (aln.IsAligned) {
                             s.Lengths.emplace_back(aln.NumAlignedBases);
                             s.Bases += aln.NumAlignedBases;
@@ -228,70 +425,228 @@ int AlignWorkflow::Runner(const CLI_v2::Results& options)
                         const std::string movieName = aln.Record.MovieName();
                         const auto& sampleInfix = mtsti[movieName];
                         writers->at(sampleInfix.second, sampleInfix.first).Write(aln.Record);
-                        if (aln.IsAligned && ++alignedRecords % settings.ChunkSize == 0) {
-                            const auto now = std::chrono::steady_clock::now();
-                            auto elapsedSecs =
-                                std::chrono::duration_cast<std::chrono::seconds>(now - lastTime)
-                                    .count();
-                            if (elapsedSecs > 5) {
-                                lastTime = now;
-                                auto elapsedSecTotal =
-                                    std::chrono::duration_cast<std::chrono::seconds>(now -
-                                                                                     firstTime)
-                                        .count() /
-                                    60.0;
-                                auto alnsPerMin = std::round(alignedReads / elapsedSecTotal);
-                                PBLOG_DEBUG << "#Reads, #Aln, #RPM: " << alignedReads << ", "
-                                            << alignedRecords << ", " << alnsPerMin;
-                            }
+                        if (!aln.IsAligned) continue;
+                        if (!written) {
+                            written = true;
+                            ++alignedReads;
+                        }
+                        if (++alignedRecords % settings.ChunkSize != 0) continue;
+                        const auto now = std::chrono::steady_clock::now();
+                        auto elapsedSecs =
+                            std::chrono::duration_cast<std::chrono::seconds>(now - lastTime)
+                                .count();
+                        if (elapsedSecs > 5) {
+                            lastTime = now;
+                            auto elapsedSecTotal =
+                                std::chrono::duration_cast<std::chrono::seconds>(now - firstTime)
+                                    .count() /
+                                60.0;
+                            auto alnsPerMin = std::round(alignedReads / elapsedSecTotal);
+                            PBLOG_DEBUG << "#Reads, #Aln, #RPM: " << alignedReads << ", "
+                                        << alignedRecords << ", " << alnsPerMin;
                         }
                     }
                 }
-            } catch (...) {
-                std::cerr << "ERROR" << std::endl;
             }
-            waiting--;
+            if (checkpoint) {
+                {
+                    std::lock_guard<std::mutex> lock(chunkSizesMutex);
+                    emittedInputReads += chunkSizes.front();
+                    chunkSizes.pop_front();
+                }
+                // between two chunks, all earlier reads are written and no later one
+                if (checkpoint->IsDue()) {
+                    checkpoint->Save(emittedInputReads, alignedReads, s, writers->CloseFragments());
+                    // leaves the checkpoint like a killed run, to test --resume
+                    if (settings.StopAfterCheckpoint)
+                        throw AbortException("Stopped after checkpoint " + checkpoint->Directory() +
+                                             ", as requested by --stop-after-checkpoint");
+                }
+            }
         };
-
-        const auto FastxToUnalignedBam = [&hdr, &fastxRgId](const std::string& seq,
-                                                            const std::string& name,
-                                                            const std::string& qual) {
-            BAM::BamRecord record(hdr);
-            record.Impl().SetSequenceAndQualities(seq, qual);
-            record.ReadGroupId(fastxRgId);
-            record.Impl().Name(name);
-            record.Impl().AddTag("qs", 0);
-            record.Impl().AddTag("qe", static_cast<int32_t>(seq.size()));
-            return record;
+        const auto refs = mm2helper->SequenceInfos();
+        // called serially, in input order
+        const auto EmitChains = [&](const std::vector<BAM::BamRecord>& reads,
+                                    const std::vector<std::vector<MappingHit>>& hits) {
+            for (size_t i = 0; i < reads.size(); ++i) {
+                const std::string name = reads[i].FullName();
+                const int32_t qlen = reads[i].Impl().SequenceLength();
+                bool mapped = false;
+                // reads whose chains are all dropped by the cap are neither
+                // mapped nor unmapped
+                bool capped = false;
+                for (const auto& hit : hits[i]) {
+                    const int32_t span = hit.QueryEnd - hit.QueryStart;
+                    if (span <= 0 || span < settings.MinAlignmentLength) continue;
+                    if (coverageCap && !coverageCap->Add(hit.RefId, hit.RefStart, hit.RefEnd)) {
+                        capped = true;
+                        continue;
+                    }
+                    const auto& ref = refs[hit.RefId];
+                    paf << name << '\t' << qlen << '\t' << hit.QueryStart << '\t' << hit.QueryEnd
+                        << '\t' << (hit.Reverse ? '-' : '+') << '\t' << ref.Name() << '\t'
+                        << ref.Length() << '\t' << hit.RefStart << '\t' << hit.RefEnd << '\t'
+                        << hit.NumMatches << '\t' << hit.BlockLength << '\t'
+                        << static_cast<int32_t>(hit.MapQuality)
+                        << "\ttp:A:P\tcm:i:" << hit.NumMinimizers << "\ts1:i:" << hit.ChainScore
+                        << '\n';
+                    s.Lengths.emplace_back(span);
+                    s.Bases += span;
+                    sumMapQuality += hit.MapQuality;
+                    ++s.NumAlns;
+                    mapped = true;
+                }
+                if (mapped)
+                    ++alignedReads;
+                else if (settings.OutputUnmapped && !capped)
+                    paf << name << '\t' << qlen << "\t0\t0\t*\t*\t0\t0\t0\t0\t0\t0\n";
+            }
+        };
+        // ZMW stitching threads are part of -j, a quarter is enough to keep
+        // the align workers busy
+        const bool stitchZmws = !uio.isFastaInput && !uio.isFastqInput && !uio.isAlignedInput &&
+                                !settings.MedianFilter && (settings.ZMW || settings.HQRegion);
+        const int32_t stitchThreads = stitchZmws ? std::max(1, settings.NumThreads / 4) : 0;
+        const int32_t alignThreads = std::max(1, settings.NumThreads - stitchThreads);
+
+        // one buffer per chunk in flight and the one being filled
+        RecordPool pool{settings.ChunkSize, 3 * alignThreads + 1};
+        std::unique_ptr<AlignScheduler> scheduler;
+        if (settings.MappingOnly)
+            scheduler = std::make_unique<AlignScheduler>(*mm2helper, Prepare, EmitChains, budget,
+                                                         pool, alignThreads);
+        else
+            scheduler = std::make_unique<AlignScheduler>(*mm2helper, filter, Prepare, Emit, budget,
+                                                         pool, alignThreads);
+
+        auto records = pool.TakeChunk();
+        const auto NewFastxChunk = [&settings]() {
+            auto chunk = std::make_unique<std::vector<FastxRecord>>();
+            chunk->reserve(settings.ChunkSize);
+            return chunk;
+        };
+        auto fastxReads = NewFastxChunk();
+        int64_t bases = 0;
+        const auto SubmitChunk = [&]() {
+            const size_t chunkSize = !fastxReads->empty() ? fastxReads->size() : records->size();
+            if (checkpoint && chunkSize > 0) {
+                std::lock_guard<std::mutex> lock(chunkSizesMutex);
+                chunkSizes.emplace_back(chunkSize);
+            }
+            if (!fastxReads->empty()) {
+                scheduler->Submit(std::move(fastxReads));
+                fastxReads = NewFastxChunk();
+            } else if (!records->empty()) {
+                scheduler->Submit(std::move(records));
+                records = pool.TakeChunk();
+            }
+            bases = 0;
+        };
+        int32_t numInputReads = 0;
+        bool coverageReached = false;
+        const auto InputDone = [&]() {
+            if (settings.MaxReads > 0 && numInputReads >= settings.MaxReads) return true;
+            if (!coverageCap || !coverageCap->IsSaturated()) return false;
+            if (!coverageReached) {
+                coverageReached = true;
+                PBLOG_INFO << "Reference is covered " << settings.MaxCoverage
+                           << "-fold, stopped reading after " << numInputReads << " input reads";
+            }
+            return true;
+        };
+        // Tags are removed in place, which keeps the order of the remaining
+        // tags and never decodes them. HasTag is a lookup in pbbam's tag
+        // index, thus only tags that are present are searched and moved over.
+        const bool stripTags = settings.Strip || settings.CompressSequenceHomopolymers;
+        const auto StripTags = [](BAM::BamRecord& record) {
+            static const std::array<const char*, 19> stripped{
+                {"dq", "dt", "ip", "iq", "mq", "pa", "pc", "pd", "pe", "pg", "pm", "pq", "pt", "pv",
+                 "pw", "px", "sf", "sq", "st"}};
+            auto& impl = record.Impl();
+            for (const char* tag : stripped)
+                if (impl.HasTag(tag)) impl.RemoveTag(tag);
+        };
+        // Read cap, resumed reads, and the chunk budget for both read types.
+        // prepare edits an accepted read and returns its number of bases.
+        // Returns false once no more reads are accepted.
+        const auto AddRead = [&](auto&& read, auto& chunk, const auto& prepare) {
+            if (InputDone()) return false;
+            ++numInputReads;
+            if (skipInputReads > 0) {
+                --skipInputReads;
+                return true;
+            }
+            bases += prepare(read);
+            chunk->emplace_back(std::move(read));
+            if (budget.IsFull(static_cast<int32_t>(chunk->size()), bases)) SubmitChunk();
+            return true;
+        };
+        const auto AddRecord = [&](BAM::BamRecord&& record) {
+            return AddRead(std::move(record), records, [&](BAM::BamRecord& r) -> int64_t {
+                // before queueing, stripped data never reaches the align stage
+                if (stripTags) StripTags(r);
+                return r.Impl().SequenceLength();
+            });
         };
 
-        if (uio.isFastaInput) {
-            for (const auto& f : uio.inputFiles) {
-                BAM::FastaReader reader(f);
-                BAM::FastaSequence fa;
-                while (reader.GetNext(fa)) {
-                    (*records)[i++] = FastxToUnalignedBam(fa.Bases(), fa.Name(), "");
-                    if (i >= chunkSize) {
-                        waiting++;
-                        faf.ProduceWith(Submit, std::move(records));
-                        records = std::make_unique<std::vector<BAM::BamRecord>>(chunkSize);
-                        i = 0;
-                    }
+        // FASTX reads are only encoded as BAM once they are written,
+        // chains of --mapping-only are computed on records
+        const auto AddFastx = [&](FastxRecord read) {
+            read.Header = hdr;
+            read.ReadGroupId = fastxRgId;
+            if (settings.MappingOnly) return AddRecord(read.ToBam());
+            return AddRead(std::move(read), fastxReads, [&](FastxRecord& r) -> int64_t {
+                if (settings.CompressSequenceHomopolymers) {
+                    r.Bases = CompressHomopolymers(r.Bases);
+                    r.Qualities.clear();
                 }
+                return r.Bases.size();
+            });
+        };
+
+        // Decodes the BAM files of a FOFN or dataset concurrently, at most
+        // --max-open-files at a time, and adds their records in input order.
+        // Returns false for a single BAM file, which is read directly.
+        const auto FillConcurrently = [&](const bool alignedInput) {
+            auto tasks = BamFileTasks(
+                uio.isFromJson ? std::vector<std::string>{uio.unpackedFromJson} : uio.inputFiles,
+                alignedInput);
+            if (tasks.size() < 2) return false;
+            PBLOG_TRACE << "Reading " << tasks.size() << " BAM files using "
+                        << std::min<int32_t>(settings.MaxOpenFiles, tasks.size()) << " threads";
+            OrderedParallelReader reader(std::move(tasks), settings.MaxOpenFiles);
+            BAM::BamRecord record;
+            while (reader.GetNext(record)) {
+                if (!AddRecord(std::move(record))) break;
+                record = BAM::BamRecord();
+            }
+            return true;
+        };
+
+        // stdin or a pipe, without .pbi records are tested after decoding
+        const auto FillFromStream = [&](const bool alignedInput) {
+            auto& reader = uio.stream->BamReader();
+            auto record = pool.TakeRecord();
+            while (reader.GetNext(record)) {
+                if (alignedInput && record.Impl().IsSupplementaryAlignment()) continue;
+                if (!inputFilter.IsEmpty() && !inputFilter.Accepts(record)) continue;
+                if (!AddRecord(std::move(record))) break;
+                record = pool.TakeRecord();
             }
-        } else if (uio.isFastqInput) {
+        };
+
+        if (uio.isFastaInput || uio.isFastqInput) {
             for (const auto& f : uio.inputFiles) {
-                BAM::FastqReader reader(f);
-                BAM::FastqSequence fq;
-                while (reader.GetNext(fq)) {
-                    (*records)[i++] =
-                        FastxToUnalignedBam(fq.Bases(), fq.Name(), fq.Qualities().Fastq());
-                    if (i >= chunkSize) {
-                        waiting++;
-                        faf.ProduceWith(Submit, std::move(records));
-                        records = std::make_unique<std::vector<BAM::BamRecord>>(chunkSize);
-                        i = 0;
-                    }
+                FastxReader reader(f, settings.NumThreads);
+                uint64_t shardBegin;
+                uint64_t shardEnd;
+                const bool byteRange = inputFilter.ShardByteRange(f, &shardBegin, &shardEnd) &&
+                                       reader.Restrict(shardBegin, shardEnd);
+                FastxRecord read;
+                while (reader.GetNext(&read)) {
+                    if (!inputFilter.Accepts(read.Name, read.Bases.size())) continue;
+                    if (!byteRange && !inputFilter.AcceptsShard(read.Name)) continue;
+                    if (!AddFastx(std::move(read))) break;
                 }
             }
         } else if (uio.isAlignedInput) {
@@ -301,108 +656,75 @@ int AlignWorkflow::Runner(const CLI_v2::Results& options)
             if (settings.HQRegion) PBLOG_WARN << "Option --hqregion is ignored with aligned input!";
 
             const auto Fill = [&](const std::string& f) {
-                auto reader = BamQueryFile(f);
-                BAM::BamRecord tmp;
+                bool filterRecords;
+                auto reader = BamQueryFile(f, &filterRecords);
+                auto tmp = pool.TakeRecord();
                 while (reader->GetNext(tmp)) {
                     if (tmp.Impl().IsSupplementaryAlignment()) continue;
-                    (*records)[i++] = std::move(tmp);
-                    tmp = BAM::BamRecord();
-                    if (i >= chunkSize) {
-                        waiting++;
-                        faf.ProduceWith(Submit, std::move(records));
-                        records = std::make_unique<std::vector<BAM::BamRecord>>(chunkSize);
-                        i = 0;
-                    }
+                    if (filterRecords && !inputFilter.Accepts(tmp)) continue;
+                    if (!AddRecord(std::move(tmp))) break;
+                    tmp = pool.TakeRecord();
                 }
             };
-            if (uio.isFromJson) {
-                Fill(uio.unpackedFromJson);
-            } else {
-                for (const auto& f : uio.inputFiles)
-                    Fill(f);
+            if (uio.isFromStream) {
+                FillFromStream(true);
+            } else if (!FillConcurrently(true)) {
+                if (uio.isFromJson) {
+                    Fill(uio.unpackedFromJson);
+                } else {
+                    for (const auto& f : uio.inputFiles)
+                        Fill(f);
+                }
             }
         } else if (settings.MedianFilter) {
-            struct RecordAnnotated
-            {
-                RecordAnnotated(BAM::BamRecord record)
-                    : Record(std::move(record)), Length(Record.Sequence().size())
-                {
-                    if (Record.HasLocalContextFlags()) {
-                        const auto flags = Record.LocalContextFlags();
-                        if (flags & Data::ADAPTER_BEFORE && flags & Data::ADAPTER_AFTER) {
-                            FullLength = true;
-                        }
-                    }
-                }
-
-                BAM::BamRecord Record;
-                int32_t Length;
-                bool FullLength = false;
-            };
-
+            const bool trace = options.LogLevel() == Logging::LogLevel::TRACE;
             std::string movieName;
             int32_t holeNumber = -1;
-
-            const auto PickMedian = [&](std::vector<RecordAnnotated> tmp) {
-                bool hasFullLength = false;
-                for (const auto& ra : tmp) {
-                    if (ra.FullLength) {
-                        hasFullLength = true;
-                        break;
+            std::vector<BAM::BamRecord> zmwRecords;
+            const auto Flush = [&]() {
+                if (zmwRecords.empty()) return;
+                std::vector<MedianCandidate> candidates;
+                candidates.reserve(zmwRecords.size());
+                for (size_t i = 0; i < zmwRecords.size(); ++i) {
+                    const auto& record = zmwRecords[i];
+                    bool fullLength = false;
+                    if (record.HasLocalContextFlags()) {
+                        const auto flags = record.LocalContextFlags();
+                        fullLength = flags & Data::ADAPTER_BEFORE && flags & Data::ADAPTER_AFTER;
                     }
+                    candidates.emplace_back(MedianCandidate{
+                        static_cast<int32_t>(record.Impl().SequenceLength()), fullLength, i});
                 }
-                if (hasFullLength) {
-                    std::vector<RecordAnnotated> fullLengths;
-                    fullLengths.reserve(tmp.size());
-                    for (auto&& ra : tmp)
-                        if (ra.FullLength) fullLengths.emplace_back(std::move(ra));
-                    tmp.swap(fullLengths);
+                const size_t mid = MedianFilter::Pick(candidates);
+                auto& median = zmwRecords[candidates[mid].Index];
+                if (trace) {
+                    PBLOG_TRACE << "Median filter " << median.MovieName() << '/'
+                                << median.HoleNumber() << ": "
+                                << MedianFilter::Describe(candidates, mid);
                 }
-
-                std::stable_sort(tmp.begin(), tmp.end(),
-                                 [&](const RecordAnnotated& l, const RecordAnnotated& r) {
-                                     return std::tie(l.FullLength, l.Length) <
-                                            std::tie(r.FullLength, r.Length);
-                                 });
-                size_t mid = tmp.size() / 2;
-                if (options.LogLevel() == Logging::LogLevel::TRACE) {
-                    std::ostringstream ss;
-                    for (size_t x = 0; x < tmp.size(); ++x) {
-                        const auto& ra = tmp[x];
-                        if (x == mid) ss << '[';
-                        ss << ra.Length << (ra.FullLength ? 'F' : 'S');
-                        if (x == mid) ss << ']';
-                        ss << ' ';
-                    }
-                    PBLOG_TRACE << "Median filter " << tmp.at(mid).Record.MovieName() << '/'
-                                << tmp.at(mid).Record.HoleNumber() << ": " << ss.str();
-                }
-                return tmp.at(mid).Record;
-            };
-
-            std::vector<RecordAnnotated> ras;
-            const auto Flush = [&]() {
-                if (!ras.empty()) (*records)[i++] = PickMedian(std::move(ras));
+                AddRecord(std::move(median));
+                zmwRecords.clear();
             };
 
             const auto Fill = [&](const std::string& f) {
-                auto reader = BamQueryFile(f);
+                // Select on the .pbi and decode only the median subreads
+                if (InputFilter::HasPbi(f)) {
+                    MedianFilter::FromPbi(f, inputFilter.CombinedPbiFilter(f), trace, AddRecord);
+                    return;
+                }
+                bool filterRecords;
+                auto reader = BamQueryFile(f, &filterRecords);
                 for (auto& record : *reader) {
+                    if (InputDone()) break;
+                    if (filterRecords && !inputFilter.Accepts(record)) continue;
                     const auto nextHoleNumber = record.HoleNumber();
                     const auto nextMovieName = record.MovieName();
                     if (holeNumber != nextHoleNumber || movieName != nextMovieName) {
                         Flush();
                         holeNumber = nextHoleNumber;
                         movieName = nextMovieName;
-                        ras = std::vector<RecordAnnotated>();
-                    }
-                    if (i >= chunkSize) {
-                        waiting++;
-                        faf.ProduceWith(Submit, std::move(records));
-                        records = std::make_unique<std::vector<BAM::BamRecord>>(chunkSize);
-                        i = 0;
                     }
-                    ras.emplace_back(record);
+                    zmwRecords.emplace_back(record);
                 }
                 Flush();
             };
@@ -412,48 +734,25 @@ int AlignWorkflow::Runner(const CLI_v2::Results& options)
                 for (const auto& f : uio.inputFiles)
                     Fill(f);
             }
-        } else if (settings.HQRegion) {
+        } else if (settings.ZMW || settings.HQRegion) {
             const auto Fill = [&](const std::string& f) {
-                BAM::ZmwReadStitcher reader(f);
-                while (reader.HasNext()) {
-                    auto r = reader.Next();
-                    if (r.HasVirtualRegionType(BAM::VirtualRegionType::HQREGION)) {
-                        auto hqs = r.VirtualRegionsTable(BAM::VirtualRegionType::HQREGION);
-                        if (hqs.empty()) {
-                            PBLOG_WARN << "Skipping ZMW record " << r.FullName()
-                                       << " missing HQ region";
-                        } else if (hqs.size() > 1) {
-                            PBLOG_WARN << "ZMW record " << r.FullName()
-                                       << " has more than one HQ region, will use first";
-                        }
-                        r.Clip(BAM::ClipType::CLIP_TO_QUERY, hqs.at(0).beginPos, hqs.at(0).endPos);
-                    }
-                    (*records)[i++] = std::move(r);
-                    if (i >= chunkSize) {
-                        waiting++;
-                        faf.ProduceWith(Submit, std::move(records));
-                        records = std::make_unique<std::vector<BAM::BamRecord>>(chunkSize);
-                        i = 0;
+                if (auto stitcher = ZmwStitcher::Create(f, inputFilter.CombinedPbiFilter(f, true),
+                                                        settings.HQRegion, stitchThreads)) {
+                    auto record = pool.TakeRecord();
+                    while (stitcher->GetNext(record)) {
+                        if (!inputFilter.AcceptsLength(record.Impl().SequenceLength())) continue;
+                        if (!AddRecord(std::move(record))) break;
+                        record = pool.TakeRecord();
                     }
+                    return;
                 }
-            };
-            if (uio.isFromJson) {
-                Fill(uio.unpackedFromJson);
-            } else {
-                for (const auto& f : uio.inputFiles)
-                    Fill(f);
-            }
-        } else if (settings.ZMW) {
-            const auto Fill = [&](const std::string& f) {
                 BAM::ZmwReadStitcher reader(f);
                 while (reader.HasNext()) {
-                    (*records)[i++] = reader.Next();
-                    if (i >= chunkSize) {
-                        waiting++;
-                        faf.ProduceWith(Submit, std::move(records));
-                        records = std::make_unique<std::vector<BAM::BamRecord>>(chunkSize);
-                        i = 0;
-                    }
+                    auto r = reader.Next();
+                    if (settings.HQRegion && !ZmwStitcher::ClipToHQRegion(r)) continue;
+                    if (!inputFilter.AcceptsLength(r.Impl().SequenceLength())) continue;
+                    if (!inputFilter.AcceptsZmw(r)) continue;
+                    if (!AddRecord(std::move(r))) break;
                 }
             };
             if (uio.isFromJson) {
@@ -464,43 +763,40 @@ int AlignWorkflow::Runner(const CLI_v2::Results& options)
             }
         } else {
             const auto Fill = [&](const std::string& f) {
-                auto reader = BamQueryFile(f);
-                while (reader->GetNext((*records)[i++])) {
-                    if (i >= chunkSize) {
-                        waiting++;
-                        faf.ProduceWith(Submit, std::move(records));
-                        records = std::make_unique<std::vector<BAM::BamRecord>>(chunkSize);
-                        i = 0;
-                    }
+                bool filterRecords;
+                auto reader = BamQueryFile(f, &filterRecords);
+                auto record = pool.TakeRecord();
+                while (reader->GetNext(record)) {
+                    if (filterRecords && !inputFilter.Accepts(record)) continue;
+                    if (!AddRecord(std::move(record))) break;
+                    record = pool.TakeRecord();
                 }
-                if (i > 0) i--;
             };
-            if (uio.isFromJson) {
-                Fill(uio.unpackedFromJson);
-            } else {
-                for (const auto& f : uio.inputFiles)
-                    Fill(f);
+            if (uio.isFromStream) {
+                FillFromStream(false);
+            } else if (!FillConcurrently(false)) {
+                if (uio.isFromJson) {
+                    Fill(uio.unpackedFromJson);
+                } else {
+                    for (const auto& f : uio.inputFiles)
+                        Fill(f);
+                }
             }
         }
         // terminal records, if they exist
-        if (i > 0) {
-            records->resize(i);
-            waiting++;
-            faf.ProduceWith(Submit, std::move(records));
-        }
+        SubmitChunk();
 
-        faf.Finalize();
+        scheduler->Finalize();
+        if (settings.MappingOnly) paf.flush();
 
-        while (waiting) {
-            std::this_thread::sleep_for(std::chrono::milliseconds(100));
-        }
         if (settings.Sort)
             PBLOG_DEBUG << "Alignment finished, merging sorted chunks using "
                         << (settings.NumThreads + settings.SortThreads) << " threads.";
     }
 
     alignmentTime.Freeze();
-    const auto sort_baiTimings = writers->Close();
+    std::pair<std::string, std::string> sort_baiTimings;
+    if (writers) sort_baiTimings = writers->Close();
 
     int32_t maxMappedLength = 0;
     for (const auto& l : s.Lengths) {
@@ -515,8 +811,10 @@ int AlignWorkflow::Runner(const CLI_v2::Results& options)
     std::string pbiTiming;
     if (uio.isToXML || uio.isToJson)
         pbiTiming = writers->WriteDatasetsJson(uio, s, settings.SplitBySample);
-    else if (settings.CreatePbi)
+    else if (settings.CreatePbi && writers)
         pbiTiming = writers->ForcePbiOutput();
+    // the final output is complete
+    if (checkpoint) checkpoint->Remove();
 
     PBLOG_INFO << "Mapped Reads: " << alignedReads;
     PBLOG_INFO << "Alignments: " << s.NumAlns;
@@ -529,6 +827,11 @@ int AlignWorkflow::Runner(const CLI_v2::Results& options)
         PBLOG_INFO << "Mean Gap Compressed Sequence Identity: " << meanIdentityGapComp << "%";
     PBLOG_INFO << "Max Mapped Read Length: " << maxMappedLength;
     PBLOG_INFO << "Mean Mapped Read Length: " << (1.0 * s.Bases / DenomNumAlns);
+    if (settings.MappingOnly) PBLOG_INFO << "Mean MAPQ: " << (1.0 * sumMapQuality / DenomNumAlns);
+    if (PerfCounters::IsEnabled()) {
+        for (const auto& line : PerfCounters::Report())
+            PBLOG_INFO << "Perf Counters " << line;
+    }
 
     PBLOG_INFO << "Index Build/Read Time: " << indexTime.ElapsedTime();
     PBLOG_INFO << "Alignment Time: " << alignmentTime.ElapsedTime();
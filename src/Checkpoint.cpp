@@ -0,0 +1,167 @@
+// Author: Armin Töpfer
+
+#include "Checkpoint.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+
+#include <pbcopper/json/JSON.h>
+#include <pbcopper/logging/Logging.h>
+#include <pbcopper/utility/FileUtils.h>
+
+#include "AbortException.h"
+#include "InputOutputUX.h"
+
+namespace PacBio {
+namespace minimap2 {
+namespace {
+constexpr int32_t StateVersion = 1;
+
+// closed files may still be in the page cache, a crash of the node must not lose them
+void SyncFile(const std::string& file)
+{
+    const int fd = open(file.c_str(), O_RDONLY);
+    if (fd < 0 || fsync(fd) != 0) {
+        if (fd >= 0) close(fd);
+        throw AbortException("Could not write checkpoint file " + file);
+    }
+    close(fd);
+}
+
+// makes the renamed state file and new fragments, the entries of dir, durable
+void SyncDirectory(const std::string& dir)
+{
+    const int fd = open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+    if (fd < 0 || fsync(fd) != 0) {
+        if (fd >= 0) close(fd);
+        throw AbortException("Could not write checkpoint directory " + dir);
+    }
+    close(fd);
+}
+}  // namespace
+
+Checkpoint::Checkpoint(const std::string& outPrefix, const int32_t intervalMinutes,
+                       const int32_t intervalChunks, const bool resume, std::string signature)
+    : dir_(outPrefix + ".pbmm2.checkpoint")
+    , stateFile_(dir_ + "/state.json")
+    , signature_(std::move(signature))
+    , interval_(intervalMinutes)
+    , intervalChunks_(intervalChunks)
+    , last_(std::chrono::steady_clock::now())
+{
+    if (!resume) {
+        if (Utility::FileExists(dir_)) {
+            PBLOG_WARN << "Warning: Overwriting existing checkpoint: " << dir_;
+            Remove();
+        }
+        if (mkdir(dir_.c_str(), 0755) != 0)
+            throw AbortException("Could not create checkpoint directory " + dir_);
+        return;
+    }
+
+    if (!Utility::FileExists(stateFile_))
+        throw AbortException("Cannot resume, there is no checkpoint in " + dir_);
+    auto j = InputOutputUX::ReadJson(stateFile_);
+    if (j["version"].get<int32_t>() != StateVersion ||
+        j["signature"].get<std::string>() != signature_)
+        throw AbortException("Checkpoint in " + dir_ +
+                             " was taken with different input, reference, or output options");
+    if (intervalMinutes == 0 && intervalChunks == 0) {
+        interval_ = std::chrono::minutes(j["interval"].get<int32_t>());
+        intervalChunks_ = j["intervalChunks"].get<int32_t>();
+    }
+
+    resumed_.NumInputReads = j["numInputReads"].get<int64_t>();
+    resumed_.AlignedReads = j["alignedReads"].get<int64_t>();
+    resumed_.Stats.NumAlns = j["numAlns"].get<int32_t>();
+    resumed_.Stats.Bases = j["bases"].get<int64_t>();
+    resumed_.Stats.Concordance = j["concordance"].get<double>();
+    resumed_.Stats.Identity = j["identity"].get<double>();
+    resumed_.Stats.IdentityGapComp = j["identityGapComp"].get<double>();
+    resumed_.Stats.Lengths.emplace_back(j["maxLength"].get<int32_t>());
+    for (const auto& f : j["fragments"]) {
+        OutputFragment fragment{f["sample"].get<std::string>(), f["infix"].get<std::string>(),
+                                dir_ + '/' + f["file"].get<std::string>()};
+        if (!Utility::FileExists(fragment.File))
+            throw AbortException("Cannot resume, checkpoint file is missing: " + fragment.File);
+        resumed_.Fragments.emplace_back(std::move(fragment));
+    }
+    PBLOG_INFO << "Resuming after " << resumed_.NumInputReads << " input reads from " << dir_;
+}
+
+const std::string& Checkpoint::Directory() const { return dir_; }
+
+const Checkpoint::State& Checkpoint::Resumed() const { return resumed_; }
+
+bool Checkpoint::IsDue()
+{
+    ++chunksSinceLast_;
+    if (intervalChunks_ > 0) return chunksSinceLast_ >= intervalChunks_;
+    return std::chrono::steady_clock::now() - last_ >= interval_;
+}
+
+void Checkpoint::Save(const int64_t numInputReads, const int64_t alignedReads, const Summary& stats,
+                      const std::vector<OutputFragment>& fragments)
+{
+    int32_t maxLength = 0;
+    for (const auto l : stats.Lengths)
+        maxLength = std::max(maxLength, l);
+
+    JSON::Json j;
+    j["version"] = StateVersion;
+    j["signature"] = signature_;
+    j["interval"] = static_cast<int32_t>(interval_.count());
+    j["intervalChunks"] = intervalChunks_;
+    j["numInputReads"] = numInputReads;
+    j["alignedReads"] = alignedReads;
+    j["numAlns"] = stats.NumAlns;
+    j["bases"] = stats.Bases;
+    j["concordance"] = stats.Concordance;
+    j["identity"] = stats.Identity;
+    j["identityGapComp"] = stats.IdentityGapComp;
+    j["maxLength"] = maxLength;
+    std::vector<JSON::Json> files;
+    for (const auto& fragment : fragments) {
+        SyncFile(fragment.File);
+        JSON::Json f;
+        f["sample"] = fragment.Sample;
+        f["infix"] = fragment.Infix;
+        f["file"] = fragment.File.substr(dir_.size() + 1);
+        files.emplace_back(f);
+    }
+    j["fragments"] = files;
+
+    const std::string tmpFile = stateFile_ + ".tmp";
+    {
+        std::ofstream out(tmpFile);
+        out << j.dump(2);
+        if (!out.flush()) throw AbortException("Could not write checkpoint file " + tmpFile);
+    }
+    SyncFile(tmpFile);
+    if (std::rename(tmpFile.c_str(), stateFile_.c_str()) != 0)
+        throw AbortException("Could not write checkpoint file " + stateFile_);
+    SyncDirectory(dir_);
+    last_ = std::chrono::steady_clock::now();
+    chunksSinceLast_ = 0;
+    PBLOG_INFO << "Checkpoint after " << numInputReads << " input reads";
+}
+
+void Checkpoint::Remove() const
+{
+    if (DIR* d = opendir(dir_.c_str())) {
+        while (const dirent* entry = readdir(d)) {
+            const std::string name = entry->d_name;
+            if (name != "." && name != "..") unlink((dir_ + '/' + name).c_str());
+        }
+        closedir(d);
+    }
+    rmdir(dir_.c_str());
+}
+}  // namespace minimap2
+}  // namespace PacBio
@@ -0,0 +1,66 @@
+// Author: Armin Töpfer
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "StreamWriters.h"
+
+namespace PacBio {
+namespace minimap2 {
+/// Progress of an align run with --checkpoint-interval, kept in the directory
+/// <out prefix>.pbmm2.checkpoint until the final output is complete.
+///
+/// Checkpoints are taken between two emitted chunks. The saved state lists
+/// the closed output fragments, which hold all alignments of the first
+/// NumInputReads input reads, and the statistics of the log. --resume skips
+/// these reads and continues with new fragments.
+class Checkpoint
+{
+public:
+    struct State
+    {
+        int64_t NumInputReads = 0;
+        int64_t AlignedReads = 0;
+        // Lengths only holds the maximum
+        Summary Stats;
+        std::vector<OutputFragment> Fragments;
+    };
+
+public:
+    /// The signature describes input and output, a resumed run must match it.
+    /// A positive intervalChunks takes precedence over intervalMinutes.
+    Checkpoint(const std::string& outPrefix, int32_t intervalMinutes, int32_t intervalChunks,
+               bool resume, std::string signature);
+
+    const std::string& Directory() const;
+
+    /// State of the interrupted run with --resume, empty otherwise
+    const State& Resumed() const;
+
+    /// Counts an emitted chunk, true once the interval has passed since the
+    /// last checkpoint
+    bool IsDue();
+
+    /// Fragments must be closed, the state file is replaced atomically
+    void Save(int64_t numInputReads, int64_t alignedReads, const Summary& stats,
+              const std::vector<OutputFragment>& fragments);
+
+    /// Deletes the directory, once the final output is complete
+    void Remove() const;
+
+private:
+    const std::string dir_;
+    const std::string stateFile_;
+    const std::string signature_;
+    std::chrono::minutes interval_;
+    int32_t intervalChunks_;
+    std::chrono::steady_clock::time_point last_;
+    int32_t chunksSinceLast_ = 0;
+    State resumed_;
+};
+}  // namespace minimap2
+}  // namespace PacBio
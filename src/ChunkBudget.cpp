@@ -0,0 +1,44 @@
+// Author: Armin Töpfer
+
+#include "ChunkBudget.h"
+
+#include <algorithm>
+
+namespace PacBio {
+namespace minimap2 {
+constexpr int64_t ChunkBudget::InitialBases;
+constexpr int64_t ChunkBudget::MinBases;
+constexpr int64_t ChunkBudget::MaxBases;
+constexpr double ChunkBudget::TargetSeconds;
+
+ChunkBudget::ChunkBudget(const int64_t fixedBases, const int32_t maxRecords)
+    : autoTune_(fixedBases <= 0)
+    , maxRecords_(std::max(1, maxRecords))
+    , targetBases_(fixedBases > 0 ? fixedBases : InitialBases)
+{}
+
+bool ChunkBudget::IsFull(const int32_t numRecords, const int64_t numBases) const
+{
+    return numRecords >= maxRecords_ || numBases >= targetBases_;
+}
+
+int64_t ChunkBudget::TargetBases() const { return targetBases_; }
+
+void ChunkBudget::Observe(const int64_t numBases, const double seconds)
+{
+    if (!autoTune_ || numBases <= 0 || seconds <= 0) return;
+
+    // Chunks that hit the record cap early are as informative as full ones,
+    // throughput is independent of the chunk size.
+    static constexpr double smoothing = 0.2;
+    const double observed = numBases / seconds;
+    std::lock_guard<std::mutex> lock(observeMutex_);
+    if (basesPerSecond_ <= 0)
+        basesPerSecond_ = observed;
+    else
+        basesPerSecond_ = smoothing * observed + (1 - smoothing) * basesPerSecond_;
+    const auto target = static_cast<int64_t>(basesPerSecond_ * TargetSeconds);
+    targetBases_ = std::max(MinBases, std::min(MaxBases, target));
+}
+}  // namespace minimap2
+}  // namespace PacBio
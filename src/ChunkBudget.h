@@ -0,0 +1,42 @@
+// Author: Armin Töpfer
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+
+namespace PacBio {
+namespace minimap2 {
+/// Decides when a chunk of input records is full. A chunk is limited by the
+/// number of records and by the number of bases, as mapping cost grows with
+/// read length. Without a fixed base budget, the budget follows the observed
+/// alignment throughput such that one chunk takes about TargetSeconds.
+class ChunkBudget
+{
+public:
+    static constexpr int64_t InitialBases = 1 << 20;
+    static constexpr int64_t MinBases = 1 << 14;
+    static constexpr int64_t MaxBases = 1 << 26;
+    static constexpr double TargetSeconds = 0.5;
+
+public:
+    /// fixedBases of 0 enables runtime tuning
+    ChunkBudget(int64_t fixedBases, int32_t maxRecords);
+
+    bool IsFull(int32_t numRecords, int64_t numBases) const;
+    int64_t TargetBases() const;
+
+    /// Reports the summed worker time spent aligning a chunk
+    void Observe(int64_t numBases, double seconds);
+
+private:
+    const bool autoTune_;
+    const int32_t maxRecords_;
+    std::atomic<int64_t> targetBases_;
+
+    std::mutex observeMutex_;
+    double basesPerSecond_ = 0;
+};
+}  // namespace minimap2
+}  // namespace PacBio
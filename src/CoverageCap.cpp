@@ -0,0 +1,56 @@
+// Author: Armin Töpfer
+
+#include "CoverageCap.h"
+
+#include <algorithm>
+#include <string>
+
+namespace PacBio {
+namespace minimap2 {
+CoverageCap::CoverageCap(const std::vector<BAM::SequenceInfo>& refs, const double maxDepth)
+    : maxDepth_(maxDepth)
+{
+    for (const auto& ref : refs) {
+        const int32_t length = std::stoi(ref.Length());
+        const int32_t numBins = (length + BinSize - 1) / BinSize;
+        bases_.emplace_back(numBins, 0);
+        binLengths_.emplace_back(numBins, BinSize);
+        if (numBins > 0) binLengths_.back().back() = length - (numBins - 1) * BinSize;
+        numOpenBins_ += numBins;
+    }
+    maxOpenBins_ = static_cast<int64_t>(numOpenBins_ * (1 - SaturatedFraction));
+    saturated_ = numOpenBins_ <= maxOpenBins_;
+}
+
+bool CoverageCap::Add(const int32_t refId, const int32_t refStart, const int32_t refEnd)
+{
+    if (refId < 0 || refId >= static_cast<int32_t>(bases_.size()) || refEnd <= refStart)
+        return true;
+    auto& bases = bases_[refId];
+    const auto& binLengths = binLengths_[refId];
+    const int32_t firstBin = refStart / BinSize;
+    const int32_t lastBin = std::min<int32_t>((refEnd - 1) / BinSize, bases.size() - 1);
+
+    const auto IsFull = [&](const int32_t bin) {
+        return bases[bin] >= maxDepth_ * binLengths[bin];
+    };
+    bool anyOpen = false;
+    for (int32_t bin = firstBin; bin <= lastBin && !anyOpen; ++bin)
+        anyOpen = !IsFull(bin);
+    if (!anyOpen) return false;
+
+    for (int32_t bin = firstBin; bin <= lastBin; ++bin) {
+        if (IsFull(bin)) continue;
+        const int32_t binStart = bin * BinSize;
+        const int32_t overlap =
+            std::min(refEnd, binStart + binLengths[bin]) - std::max(refStart, binStart);
+        bases[bin] += overlap;
+        if (IsFull(bin)) --numOpenBins_;
+    }
+    if (numOpenBins_ <= maxOpenBins_) saturated_ = true;
+    return true;
+}
+
+bool CoverageCap::IsSaturated() const { return saturated_; }
+}  // namespace minimap2
+}  // namespace PacBio
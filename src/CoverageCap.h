@@ -0,0 +1,43 @@
+// Author: Armin Töpfer
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+#include <pbbam/SequenceInfo.h>
+
+namespace PacBio {
+namespace minimap2 {
+/// Tracks the depth of emitted alignments in fixed-size reference bins.
+/// Not thread-safe, except IsSaturated; alignments are added in output order.
+/// Bins that cannot be covered, e.g., gaps and repeats, are tolerated by
+/// saturating once SaturatedFraction of all bins are covered.
+class CoverageCap
+{
+public:
+    static constexpr int32_t BinSize = 10000;
+    static constexpr double SaturatedFraction = 0.99;
+
+public:
+    CoverageCap(const std::vector<BAM::SequenceInfo>& refs, double maxDepth);
+
+    /// Returns false if all bins overlapped by the alignment are covered
+    /// maxDepth-fold, otherwise adds its coverage.
+    bool Add(int32_t refId, int32_t refStart, int32_t refEnd);
+
+    /// True once SaturatedFraction of all bins are covered maxDepth-fold
+    bool IsSaturated() const;
+
+private:
+    const double maxDepth_;
+    // aligned bases per bin
+    std::vector<std::vector<int64_t>> bases_;
+    std::vector<std::vector<int32_t>> binLengths_;
+    int64_t numOpenBins_ = 0;
+    int64_t maxOpenBins_ = 0;
+    std::atomic_bool saturated_{false};
+};
+}  // namespace minimap2
+}  // namespace PacBio
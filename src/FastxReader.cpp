@@ -0,0 +1,321 @@
+// Author: Armin Töpfer
+
+#include "FastxReader.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cctype>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <thread>
+
+#include <htslib/bgzf.h>
+
+#include "AbortException.h"
+
+namespace PacBio {
+namespace minimap2 {
+/// Compressed or streamed input, handed out in blocks
+class FastxReader::Source
+{
+public:
+    static constexpr size_t BlockSize = 4 << 20;
+
+public:
+    virtual ~Source() = default;
+
+    /// Appends the next block, returns false at the end of the input
+    virtual bool Append(std::string* buffer) = 0;
+};
+
+namespace {
+using BgzfPtr = std::unique_ptr<BGZF, int (*)(BGZF*)>;
+
+size_t ReadBlock(BGZF* fp, char* out, const std::string& file)
+{
+    const auto n = bgzf_read(fp, out, FastxReader::Source::BlockSize);
+    if (n < 0) throw AbortException("Could not read input file " + file);
+    return static_cast<size_t>(n);
+}
+
+// BGZF, blocks are inflated ahead by the thread pool attached to the handle
+class BgzfSource : public FastxReader::Source
+{
+public:
+    BgzfSource(BgzfPtr fp, std::string file) : fp_(std::move(fp)), file_(std::move(file)) {}
+
+    bool Append(std::string* buffer) override
+    {
+        const size_t offset = buffer->size();
+        buffer->resize(offset + BlockSize);
+        const size_t n = ReadBlock(fp_.get(), &(*buffer)[offset], file_);
+        buffer->resize(offset + n);
+        return n > 0;
+    }
+
+private:
+    BgzfPtr fp_;
+    const std::string file_;
+};
+
+// Plain gzip and streams, a single thread reads ahead of parsing
+class ReadAheadSource : public FastxReader::Source
+{
+public:
+    static constexpr size_t MaxQueued = 4;
+
+public:
+    ReadAheadSource(BgzfPtr fp, std::string file) : fp_(std::move(fp)), file_(std::move(file))
+    {
+        thread_ = std::thread([this]() { Run(); });
+    }
+
+    ~ReadAheadSource() override
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        consumed_.notify_all();
+        thread_.join();
+    }
+
+    bool Append(std::string* buffer) override
+    {
+        std::string block;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            produced_.wait(lock, [this]() { return !blocks_.empty() || done_; });
+            if (blocks_.empty()) {
+                if (error_) std::rethrow_exception(error_);
+                return false;
+            }
+            block = std::move(blocks_.front());
+            blocks_.pop_front();
+        }
+        consumed_.notify_one();
+        buffer->append(block);
+        return true;
+    }
+
+private:
+    void Run()
+    {
+        try {
+            while (true) {
+                std::string block(BlockSize, '\0');
+                block.resize(ReadBlock(fp_.get(), &block[0], file_));
+                if (block.empty()) break;
+                std::unique_lock<std::mutex> lock(mutex_);
+                consumed_.wait(lock, [this]() { return blocks_.size() < MaxQueued || stop_; });
+                if (stop_) break;
+                blocks_.emplace_back(std::move(block));
+                produced_.notify_one();
+            }
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            error_ = std::current_exception();
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            done_ = true;
+        }
+        produced_.notify_one();
+    }
+
+private:
+    BgzfPtr fp_;
+    const std::string file_;
+
+    std::mutex mutex_;
+    std::condition_variable produced_;
+    std::condition_variable consumed_;
+    std::deque<std::string> blocks_;
+    bool done_ = false;
+    bool stop_ = false;
+    std::exception_ptr error_;
+    std::thread thread_;
+};
+
+constexpr size_t ReadAheadSource::MaxQueued;
+
+void TrimCarriageReturn(const char* begin, size_t* length)
+{
+    if (*length > 0 && begin[*length - 1] == '\r') --*length;
+}
+}  // namespace
+
+constexpr size_t FastxReader::Source::BlockSize;
+
+FastxReader::FastxReader(const std::string& file, const int32_t numThreads) : file_(file)
+{
+    BgzfPtr fp(bgzf_open(file.c_str(), "r"), bgzf_close);
+    if (!fp) throw AbortException("Could not open input file " + file);
+
+    const auto compression = bgzf_compression(fp.get());
+    if (compression == bgzf) {
+        if (numThreads > 1) bgzf_mt(fp.get(), numThreads, 256);
+        source_ = std::make_unique<BgzfSource>(std::move(fp), file);
+        return;
+    }
+    if (compression == no_compression) {
+        struct stat st;
+        bool regular = false;
+        const int fd = open(file.c_str(), O_RDONLY);
+        if (fd >= 0 && fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+            regular = true;
+            mappedSize_ = static_cast<size_t>(st.st_size);
+            if (mappedSize_ > 0) {
+                mapped_ = mmap(nullptr, mappedSize_, PROT_READ, MAP_PRIVATE, fd, 0);
+                if (mapped_ == MAP_FAILED) {
+                    mapped_ = nullptr;
+                } else {
+                    madvise(mapped_, mappedSize_, MADV_SEQUENTIAL);
+                    data_ = static_cast<const char*>(mapped_);
+                    size_ = mappedSize_;
+                }
+            }
+        }
+        if (fd >= 0) close(fd);
+        // an empty file has nothing to map
+        if (mapped_ || (regular && mappedSize_ == 0)) return;
+    }
+    source_ = std::make_unique<ReadAheadSource>(std::move(fp), file);
+}
+
+FastxReader::~FastxReader()
+{
+    if (mapped_) munmap(mapped_, mappedSize_);
+}
+
+bool FastxReader::Refill()
+{
+    if (!source_) return false;
+    buffer_.erase(0, pos_);
+    pos_ = 0;
+    const bool more = source_->Append(&buffer_);
+    data_ = buffer_.data();
+    size_ = buffer_.size();
+    if (!more) source_.reset();
+    return more;
+}
+
+bool FastxReader::NextLine(const char** begin, size_t* length)
+{
+    while (true) {
+        const char* start = data_ + pos_;
+        size_t available = size_ - pos_;
+        const auto* newline =
+            static_cast<const char*>(available > 0 ? std::memchr(start, '\n', available) : nullptr);
+        if (newline) {
+            *begin = start;
+            *length = newline - start;
+            pos_ += *length + 1;
+            TrimCarriageReturn(*begin, length);
+            return true;
+        }
+        if (Refill()) continue;
+        // the buffer may have been compacted
+        start = data_ + pos_;
+        available = size_ - pos_;
+        if (available == 0) return false;
+        // last line without newline
+        *begin = start;
+        *length = available;
+        pos_ = size_;
+        TrimCarriageReturn(*begin, length);
+        return true;
+    }
+}
+
+char FastxReader::Peek()
+{
+    if (pos_ == size_ && !Refill()) return '\0';
+    return data_[pos_];
+}
+
+bool FastxReader::Restrict(const uint64_t begin, const uint64_t end)
+{
+    if (source_ || pos_ != 0) return false;
+    if (!mapped_) return mappedSize_ == 0;
+    // shards agree on boundaries, as both ends are moved to the next record
+    pos_ = RecordStart(std::min<uint64_t>(begin, size_));
+    end_ = RecordStart(std::min<uint64_t>(end, size_));
+    return true;
+}
+
+size_t FastxReader::RecordStart(const size_t offset) const
+{
+    if (offset == 0 || size_ == 0) return 0;
+    const auto NextLineStart = [this](const size_t from) {
+        if (from >= size_) return size_;
+        const auto* newline =
+            static_cast<const char*>(std::memchr(data_ + from, '\n', size_ - from));
+        return newline ? static_cast<size_t>(newline - data_) + 1 : size_;
+    };
+    const bool fastq = data_[0] == '@';
+    // first line that starts at or after offset
+    size_t line = NextLineStart(offset - 1);
+    while (line < size_) {
+        if (!fastq && data_[line] == '>') return line;
+        // quality lines may start with '@' too, headers are followed by a
+        // sequence and a separator line
+        if (fastq && data_[line] == '@') {
+            const size_t separator = NextLineStart(NextLineStart(line));
+            if (separator < size_ && data_[separator] == '+') return line;
+        }
+        line = NextLineStart(line);
+    }
+    return size_;
+}
+
+bool FastxReader::GetNext(FastxRecord* read)
+{
+    const char* line;
+    size_t length;
+    do {
+        if (pos_ >= end_) return false;
+        if (!NextLine(&line, &length)) return false;
+    } while (length == 0);
+
+    const char marker = line[0];
+    if (marker != '>' && marker != '@')
+        throw AbortException("Malformed FASTA/FASTQ record in " + file_);
+    const char* nameEnd = std::find_if(line + 1, line + length, [](const char c) {
+        return std::isspace(static_cast<unsigned char>(c));
+    });
+    read->Name.assign(line + 1, nameEnd);
+    read->Bases.clear();
+    read->Qualities.clear();
+
+    if (marker == '>') {
+        while (Peek() != '>' && NextLine(&line, &length))
+            read->Bases.append(line, length);
+        return true;
+    }
+
+    while (true) {
+        if (!NextLine(&line, &length))
+            throw AbortException("Truncated FASTQ record " + read->Name + " in " + file_);
+        if (length > 0 && line[0] == '+') break;
+        read->Bases.append(line, length);
+    }
+    while (read->Qualities.size() < read->Bases.size()) {
+        if (!NextLine(&line, &length))
+            throw AbortException("Truncated FASTQ record " + read->Name + " in " + file_);
+        read->Qualities.append(line, length);
+    }
+    if (read->Qualities.size() != read->Bases.size())
+        throw AbortException("Sequence and quality lengths differ for FASTQ record " + read->Name +
+                             " in " + file_);
+    return true;
+}
+}  // namespace minimap2
+}  // namespace PacBio
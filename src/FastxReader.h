@@ -0,0 +1,64 @@
+// Author: Armin Töpfer
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <string>
+
+#include <pbmm2/MM2Helper.h>
+
+namespace PacBio {
+namespace minimap2 {
+/// FASTA/FASTQ reader for uncompressed, gzip, and bgzip files.
+///
+/// BGZF blocks are inflated in parallel by htslib's thread pool, plain gzip
+/// is inflated on a separate thread that runs ahead of parsing, and regular
+/// uncompressed files are mapped into memory. Record boundaries are found
+/// with memchr, which the C library vectorizes.
+class FastxReader
+{
+public:
+    class Source;
+
+public:
+    FastxReader(const std::string& file, int32_t numThreads);
+    ~FastxReader();
+
+    FastxReader(const FastxReader&) = delete;
+    FastxReader& operator=(const FastxReader&) = delete;
+
+    /// Sets Name, Bases, and Qualities. As with pbbam's readers, the name ends
+    /// at the first whitespace and qualities are empty for FASTA.
+    bool GetNext(FastxRecord* read);
+
+    /// Limits reading to the records that start in [begin, end). Only possible
+    /// for uncompressed files before the first read, returns false otherwise.
+    bool Restrict(uint64_t begin, uint64_t end);
+
+private:
+    size_t RecordStart(size_t offset) const;
+    bool NextLine(const char** begin, size_t* length);
+    char Peek();
+    bool Refill();
+
+private:
+    const std::string file_;
+    std::unique_ptr<Source> source_;
+
+    // mapping of an uncompressed file
+    void* mapped_ = nullptr;
+    size_t mappedSize_ = 0;
+
+    // unparsed input, points into the mapping or into buffer_
+    const char* data_ = nullptr;
+    size_t size_ = 0;
+    size_t pos_ = 0;
+    std::string buffer_;
+    // records starting at or after end_ are not read
+    size_t end_ = std::numeric_limits<size_t>::max();
+};
+}  // namespace minimap2
+}  // namespace PacBio
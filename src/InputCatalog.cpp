@@ -0,0 +1,149 @@
+// Author: Armin Töpfer
+
+#include "InputCatalog.h"
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+#include <pbbam/BamFile.h>
+#include <boost/algorithm/string.hpp>
+
+#include "AbortException.h"
+#include "InputOutputUX.h"
+
+namespace PacBio {
+namespace minimap2 {
+InputCatalog::Entry& InputCatalog::Get(const std::string& file)
+{
+    auto it = entries_.find(file);
+    if (it != entries_.end()) return it->second;
+
+    Entry entry;
+    try {
+        entry.Dataset = std::make_unique<BAM::DataSet>(file);
+    } catch (...) {
+        throw AbortException(UNKNOWN_FILE_TYPES);
+    }
+    // Same selection as DataSet::BamFiles, which would open every file
+    for (const auto& resource : entry.Dataset->ExternalResources())
+        if (boost::algorithm::icontains(resource.MetaType(), "bam"))
+            entry.BamFiles.emplace_back(entry.Dataset->ResolvePath(resource.ResourceId()));
+    return entries_.emplace(file, std::move(entry)).first->second;
+}
+
+const BAM::DataSet& InputCatalog::DataSet(const std::string& file) { return *Get(file).Dataset; }
+
+const std::vector<std::string>& InputCatalog::BamFiles(const std::string& file)
+{
+    return Get(file).BamFiles;
+}
+
+void InputCatalog::LoadHeaders(const std::vector<std::string>& files, const int32_t numThreads)
+{
+    std::vector<std::pair<const std::string*, BAM::BamHeader*>> pending;
+    for (const auto& file : files) {
+        auto& entry = Get(file);
+        if (entry.HeadersLoaded) continue;
+        entry.HeadersLoaded = true;
+        entry.Headers.resize(entry.BamFiles.size());
+        for (size_t i = 0; i < entry.BamFiles.size(); ++i)
+            pending.emplace_back(&entry.BamFiles[i], &entry.Headers[i]);
+    }
+    if (pending.empty()) return;
+
+    std::atomic<size_t> next{0};
+    std::mutex mutex;
+    std::exception_ptr error;
+    const auto Work = [&]() {
+        try {
+            for (size_t i = next++; i < pending.size(); i = next++)
+                *pending[i].second = BAM::BamFile(*pending[i].first).Header();
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!error) error = std::current_exception();
+            next = pending.size();
+        }
+    };
+    const size_t numWorkers =
+        std::min(pending.size(), static_cast<size_t>(std::max(1, numThreads)));
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < numWorkers; ++i)
+        threads.emplace_back(Work);
+    Work();
+    for (auto& t : threads)
+        t.join();
+    if (error) {
+        for (const auto& file : files)
+            Get(file).HeadersLoaded = false;
+        std::rethrow_exception(error);
+    }
+}
+
+const std::vector<BAM::BamHeader>& InputCatalog::Headers(const std::string& file)
+{
+    LoadHeaders({file}, 1);
+    return Get(file).Headers;
+}
+
+BAM::BamHeader InputCatalog::MergedHeader(const std::vector<std::string>& files)
+{
+    std::vector<const BAM::BamHeader*> headers;
+    for (const auto& file : files)
+        for (const auto& header : Headers(file))
+            headers.emplace_back(&header);
+    if (headers.empty()) throw AbortException(UNKNOWN_FILE_TYPES);
+
+    // Collect first and rebuild once, instead of merging into the header
+    // file by file
+    const auto& first = *headers.front();
+    std::map<std::string, BAM::ReadGroupInfo> readGroups;
+    std::map<std::string, BAM::ProgramInfo> programs;
+    std::vector<std::string> comments;
+    // in order of first occurrence, each name once
+    std::vector<BAM::SequenceInfo> sequences;
+    std::map<std::string, size_t> sequenceIdx;
+    for (const auto* header : headers) {
+        if (header != &first &&
+            (header->Version() != first.Version() || header->SortOrder() != first.SortOrder() ||
+             header->PacBioBamVersion() != first.PacBioBamVersion()))
+            throw AbortException(
+                "Cannot merge BAM headers with different versions or sort orders!");
+        for (auto& rg : header->ReadGroups())
+            readGroups.emplace(rg.Id(), std::move(rg));
+        for (auto& pg : header->Programs())
+            programs.emplace(pg.Id(), std::move(pg));
+        for (auto& comment : header->Comments())
+            comments.emplace_back(std::move(comment));
+        for (auto& sq : header->Sequences()) {
+            const auto it = sequenceIdx.find(sq.Name());
+            if (it == sequenceIdx.cend()) {
+                sequenceIdx.emplace(sq.Name(), sequences.size());
+                sequences.emplace_back(std::move(sq));
+            } else if (sequences[it->second].Length() != sq.Length()) {
+                throw AbortException("Cannot merge BAM headers with different lengths for @SQ " +
+                                     sq.Name() + "!");
+            }
+        }
+    }
+
+    BAM::BamHeader merged = first.DeepCopy();
+    merged.ClearReadGroups();
+    merged.ClearPrograms();
+    merged.ClearComments();
+    merged.ClearSequences();
+    for (const auto& id_rg : readGroups)
+        merged.AddReadGroup(id_rg.second);
+    for (const auto& id_pg : programs)
+        merged.AddProgram(id_pg.second);
+    for (const auto& comment : comments)
+        merged.AddComment(comment);
+    for (const auto& sq : sequences)
+        merged.AddSequence(sq);
+    return merged;
+}
+}  // namespace minimap2
+}  // namespace PacBio
@@ -0,0 +1,54 @@
+// Author: Armin Töpfer
+
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <pbbam/BamHeader.h>
+#include <pbbam/DataSet.h>
+
+namespace PacBio {
+namespace minimap2 {
+/// Parses every input dataset and reads every BAM header once per run.
+/// Not thread-safe, headers are read concurrently only inside LoadHeaders.
+class InputCatalog
+{
+public:
+    /// Parsed on first use, later calls return the cached dataset
+    const BAM::DataSet& DataSet(const std::string& file);
+
+    /// BAM files of a dataset in resource order, without opening them
+    const std::vector<std::string>& BamFiles(const std::string& file);
+
+    /// Reads the headers of all BAM files of the inputs on up to numThreads threads
+    void LoadHeaders(const std::vector<std::string>& files, int32_t numThreads);
+
+    /// Headers in BamFiles order, read on demand if not loaded yet
+    const std::vector<BAM::BamHeader>& Headers(const std::string& file);
+
+    /// Merges the headers of all BAM files of the inputs in one batch.
+    /// Read groups and programs are unique by ID, comments are kept in order.
+    /// Sequences are unique by name in order of first occurrence, as with
+    /// BAM::BamHeader::operator+=; the same name must have the same length.
+    BAM::BamHeader MergedHeader(const std::vector<std::string>& files);
+
+private:
+    struct Entry
+    {
+        std::unique_ptr<BAM::DataSet> Dataset;
+        std::vector<std::string> BamFiles;
+        std::vector<BAM::BamHeader> Headers;
+        bool HeadersLoaded = false;
+    };
+
+    Entry& Get(const std::string& file);
+
+private:
+    std::map<std::string, Entry> entries_;
+};
+}  // namespace minimap2
+}  // namespace PacBio
@@ -0,0 +1,400 @@
+// Author: Armin Töpfer
+
+#include "InputFilter.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <unordered_map>
+
+#include <boost/algorithm/string.hpp>
+
+#include <htslib/bgzf.h>
+#include <pbbam/BamFile.h>
+#include <pbbam/DataSet.h>
+#include <pbbam/PbiRawData.h>
+#include <pbbam/ReadGroupInfo.h>
+
+#include <sys/stat.h>
+
+#include "AbortException.h"
+
+namespace PacBio {
+namespace minimap2 {
+namespace {
+std::vector<std::string> ReadList(const std::string& file)
+{
+    std::vector<std::string> entries;
+    if (file.empty()) return entries;
+    std::ifstream infile(file);
+    if (!infile) throw AbortException("Could not open list file " + file);
+    std::string line;
+    while (std::getline(infile, line)) {
+        boost::trim(line);
+        if (!line.empty()) entries.emplace_back(line);
+    }
+    if (entries.empty()) throw AbortException("List file " + file + " is empty.");
+    return entries;
+}
+
+// FNV-1a, stable across platforms unlike std::hash
+uint64_t HashString(const std::string& s)
+{
+    uint64_t h = 14695981039346656037ULL;
+    for (const char c : s) {
+        h ^= static_cast<uint8_t>(c);
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+// splitmix64 finalizer
+uint64_t Mix(uint64_t x)
+{
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+// Uniform in [0, 1), a read is kept if its key is below the fraction
+double HashKey(const uint64_t hash) { return (Mix(hash) >> 11) * (1.0 / (1ULL << 53)); }
+
+bool KeepHash(const uint64_t hash, const double fraction)
+{
+    return fraction >= 1 || HashKey(hash) < fraction;
+}
+
+uint64_t ZmwHash(const uint64_t movieHash, const int32_t holeNumber)
+{
+    return movieHash ^ Mix(static_cast<uint32_t>(holeNumber));
+}
+
+bool KeepZmw(const uint64_t movieHash, const int32_t holeNumber, const double fraction)
+{
+    return KeepHash(ZmwHash(movieHash, holeNumber), fraction);
+}
+
+// Shards use the complement of the hash, such that they are independent of subsampling
+bool InShard(const uint64_t hash, const int32_t shardIndex, const int32_t numShards)
+{
+    return numShards <= 1 || Mix(~hash) % numShards == static_cast<uint64_t>(shardIndex);
+}
+
+using MovieHashes = std::unordered_map<int32_t, uint64_t>;
+
+std::shared_ptr<const MovieHashes> MovieHashesOf(const std::string& file)
+{
+    auto movieHashes = std::make_shared<MovieHashes>();
+    const BAM::DataSet ds(file);
+    for (const auto& bamFile : ds.BamFiles())
+        for (const auto& rg : bamFile.Header().ReadGroups())
+            (*movieHashes)[BAM::ReadGroupInfo::IdToInt(rg.Id())] = HashString(rg.MovieName());
+    return movieHashes;
+}
+
+uint64_t MovieHashOfRow(const MovieHashes& movieHashes, const BAM::PbiRawData& idx,
+                        const size_t row)
+{
+    const auto it = movieHashes.find(idx.BasicData().rgId_[row]);
+    return it == movieHashes.cend() ? 0 : it->second;
+}
+
+struct PbiSubsampleFilter
+{
+    std::shared_ptr<const MovieHashes> Movies;
+    double Fraction;
+
+    bool Accepts(const BAM::PbiRawData& idx, const size_t row) const
+    {
+        return KeepZmw(MovieHashOfRow(*Movies, idx, row), idx.BasicData().holeNumber_[row],
+                       Fraction);
+    }
+};
+
+struct PbiShardZmwFilter
+{
+    std::shared_ptr<const MovieHashes> Movies;
+    int32_t ShardIndex;
+    int32_t NumShards;
+
+    bool Accepts(const BAM::PbiRawData& idx, const size_t row) const
+    {
+        return InShard(ZmwHash(MovieHashOfRow(*Movies, idx, row), idx.BasicData().holeNumber_[row]),
+                       ShardIndex, NumShards);
+    }
+};
+
+struct PbiShardRangeFilter
+{
+    std::shared_ptr<const std::map<std::string, std::pair<int64_t, int64_t>>> Rows;
+    int32_t ShardIndex;
+    int32_t NumShards;
+
+    bool Accepts(const BAM::PbiRawData& idx, const size_t row) const
+    {
+        const auto it = Rows->find(idx.Filename());
+        // not planned, e.g. a path spelled differently; rows are still disjoint
+        if (it == Rows->cend()) return InShard(row, ShardIndex, NumShards);
+        const auto r = static_cast<int64_t>(row);
+        return r >= it->second.first && r < it->second.second;
+    }
+};
+
+// The number of reads follows magic, version, and flags in the .pbi header
+int64_t NumReadsFromPbi(const std::string& pbiFile)
+{
+    static constexpr int HeaderSize = 32;
+    static constexpr int NumReadsOffset = 10;
+    std::unique_ptr<BGZF, int (*)(BGZF*)> fp(bgzf_open(pbiFile.c_str(), "rb"), bgzf_close);
+    char header[HeaderSize];
+    if (!fp || bgzf_read(fp.get(), header, HeaderSize) != HeaderSize ||
+        std::strncmp(header, "PBI\1", 4) != 0)
+        throw AbortException("Could not read header of " + pbiFile);
+    uint32_t numReads;
+    std::memcpy(&numReads, header + NumReadsOffset, sizeof(numReads));
+    return numReads;
+}
+
+// Size of a regular, uncompressed file, which can be split at any byte
+bool UncompressedSize(const std::string& file, uint64_t* size)
+{
+    struct stat st;
+    if (stat(file.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) return false;
+    std::ifstream in(file, std::ios::binary);
+    char magic[2] = {0, 0};
+    in.read(magic, 2);
+    if (magic[0] == '\x1f' && magic[1] == '\x8b') return false;
+    *size = static_cast<uint64_t>(st.st_size);
+    return true;
+}
+
+// Bounds of shard i of N over total items
+uint64_t ShardBound(const uint64_t total, const int32_t i, const int32_t n)
+{
+    return static_cast<uint64_t>(static_cast<long double>(total) * i / n);
+}
+}  // namespace
+
+InputFilter::InputFilter(const AlignSettings& settings)
+    : minLength_(settings.MinReadLength)
+    , maxLength_(settings.MaxReadLength)
+    , minReadQuality_(settings.MinReadQuality)
+    , movies_(settings.IncludeMovies.cbegin(), settings.IncludeMovies.cend())
+    , subsample_(settings.Subsample)
+    , shardIndex_(settings.ShardIndex)
+    , numShards_(settings.NumShards)
+{
+    for (const auto& zmw : ReadList(settings.IncludeZmwsFile)) {
+        try {
+            zmws_.insert(std::stoi(zmw));
+        } catch (const std::exception&) {
+            throw AbortException("Invalid hole number " + zmw + " in " + settings.IncludeZmwsFile);
+        }
+    }
+    for (auto& name : ReadList(settings.IncludeNamesFile))
+        names_.insert(std::move(name));
+}
+
+bool InputFilter::IsEmpty() const
+{
+    return minLength_ == 0 && maxLength_ == 0 && !UsesPacBioFields() && names_.empty() &&
+           subsample_ >= 1 && numShards_ == 1;
+}
+
+bool InputFilter::UsesPacBioFields() const
+{
+    return minReadQuality_ > 0 || !zmws_.empty() || !movies_.empty();
+}
+
+BAM::PbiFilter InputFilter::ToPbiFilter(const std::string& file, const bool zmwOnly) const
+{
+    BAM::PbiFilter filter{BAM::PbiFilter::INTERSECT};
+    std::shared_ptr<const MovieHashes> movieHashes;
+    if (subsample_ < 1 || (numShards_ > 1 && !shardRows_)) movieHashes = MovieHashesOf(file);
+    if (subsample_ < 1) filter.Add(PbiSubsampleFilter{movieHashes, subsample_});
+    if (numShards_ > 1) {
+        if (shardRows_)
+            filter.Add(PbiShardRangeFilter{shardRows_, shardIndex_, numShards_});
+        else
+            filter.Add(PbiShardZmwFilter{movieHashes, shardIndex_, numShards_});
+    }
+    if (!zmws_.empty())
+        filter.Add(BAM::PbiZmwFilter{std::vector<int32_t>(zmws_.cbegin(), zmws_.cend())});
+    if (!movies_.empty())
+        filter.Add(
+            BAM::PbiMovieNameFilter{std::vector<std::string>(movies_.cbegin(), movies_.cend())});
+    if (zmwOnly) return filter;
+
+    if (minLength_ > 0)
+        filter.Add(BAM::PbiQueryLengthFilter{minLength_, BAM::Compare::GREATER_THAN_EQUAL});
+    if (maxLength_ > 0)
+        filter.Add(BAM::PbiQueryLengthFilter{maxLength_, BAM::Compare::LESS_THAN_EQUAL});
+    if (minReadQuality_ > 0)
+        filter.Add(BAM::PbiReadAccuracyFilter{static_cast<float>(minReadQuality_),
+                                              BAM::Compare::GREATER_THAN_EQUAL});
+    if (!names_.empty())
+        filter.Add(
+            BAM::PbiQueryNameFilter{std::vector<std::string>(names_.cbegin(), names_.cend())});
+    return filter;
+}
+
+BAM::PbiFilter InputFilter::CombinedPbiFilter(const std::string& file, const bool zmwOnly) const
+{
+    auto datasetFilter = BAM::PbiFilter::FromDataSet(file);
+    if (IsEmpty()) return datasetFilter;
+    if (datasetFilter.IsEmpty()) return ToPbiFilter(file, zmwOnly);
+    return BAM::PbiFilter::Intersection({std::move(datasetFilter), ToPbiFilter(file, zmwOnly)});
+}
+
+void InputFilter::SpreadReadCap(const int32_t maxReads, const std::vector<std::string>& files)
+{
+    for (const auto& file : files)
+        if (!HasPbi(file)) return;
+
+    // subsampling key of every read that passes all filters and the shard
+    std::vector<double> keys;
+    for (const auto& file : files) {
+        const auto filter = CombinedPbiFilter(file);
+        const auto movieHashes = MovieHashesOf(file);
+        const BAM::DataSet ds(file);
+        for (const auto& bamFile : ds.BamFiles()) {
+            const BAM::PbiRawData idx(bamFile.PacBioIndexFilename());
+            for (size_t row = 0; row < idx.NumReads(); ++row)
+                if (filter.Accepts(idx, row))
+                    keys.emplace_back(HashKey(ZmwHash(MovieHashOfRow(*movieHashes, idx, row),
+                                                      idx.BasicData().holeNumber_[row])));
+        }
+    }
+    if (static_cast<int64_t>(keys.size()) <= maxReads) return;
+
+    // keep the maxReads smallest keys; reads of one ZMW share their key, such
+    // a surplus is left to the cap that is enforced while reading
+    const auto nth = keys.begin() + (maxReads - 1);
+    std::nth_element(keys.begin(), nth, keys.end());
+    const double last = *nth;
+    double fraction = 1;
+    for (const double key : keys)
+        if (key > last) fraction = std::min(fraction, key);
+    subsample_ = std::min(subsample_, fraction);
+}
+
+void InputFilter::PlanShards(const std::vector<std::string>& files, const bool byZmw,
+                             const bool fastx)
+{
+    if (numShards_ == 1) return;
+    if (fastx) {
+        std::vector<std::pair<std::string, uint64_t>> sizes;
+        uint64_t total = 0;
+        for (const auto& file : files) {
+            uint64_t size;
+            if (!UncompressedSize(file, &size)) continue;
+            sizes.emplace_back(file, size);
+            total += size;
+        }
+        const uint64_t begin = ShardBound(total, shardIndex_, numShards_);
+        const uint64_t end = ShardBound(total, shardIndex_ + 1, numShards_);
+        uint64_t offset = 0;
+        for (const auto& file_size : sizes) {
+            if (shardBytes_.count(file_size.first) > 0)
+                throw AbortException("Cannot use --shard with input that lists " + file_size.first +
+                                     " more than once!");
+            const uint64_t fileEnd = offset + file_size.second;
+            shardBytes_[file_size.first] = {std::min(std::max(begin, offset), fileEnd) - offset,
+                                            std::min(std::max(end, offset), fileEnd) - offset};
+            offset = fileEnd;
+        }
+        return;
+    }
+
+    if (byZmw) return;
+    std::vector<std::pair<std::string, int64_t>> numReads;
+    int64_t total = 0;
+    for (const auto& file : files) {
+        if (!HasPbi(file)) return;
+        const BAM::DataSet ds(file);
+        for (const auto& bamFile : ds.BamFiles()) {
+            const auto pbiFile = bamFile.PacBioIndexFilename();
+            numReads.emplace_back(pbiFile, NumReadsFromPbi(pbiFile));
+            total += numReads.back().second;
+        }
+    }
+    const auto begin = static_cast<int64_t>(ShardBound(total, shardIndex_, numShards_));
+    const auto end = static_cast<int64_t>(ShardBound(total, shardIndex_ + 1, numShards_));
+    auto rows = std::make_shared<std::map<std::string, std::pair<int64_t, int64_t>>>();
+    int64_t offset = 0;
+    for (const auto& file_reads : numReads) {
+        // ranges are keyed by file, a second occurrence would share the first
+        if (rows->count(file_reads.first) > 0)
+            throw AbortException("Cannot use --shard with input that lists " +
+                                 boost::erase_last_copy(file_reads.first, ".pbi") +
+                                 " more than once!");
+        (*rows)[file_reads.first] = {begin - offset, end - offset};
+        offset += file_reads.second;
+    }
+    shardRows_ = std::move(rows);
+}
+
+bool InputFilter::ShardByteRange(const std::string& file, uint64_t* begin, uint64_t* end) const
+{
+    const auto it = shardBytes_.find(file);
+    if (it == shardBytes_.cend()) return false;
+    *begin = it->second.first;
+    *end = it->second.second;
+    return true;
+}
+
+bool InputFilter::AcceptsShard(const std::string& name) const
+{
+    return InShard(HashString(name), shardIndex_, numShards_);
+}
+
+bool InputFilter::AcceptsLength(const int32_t length) const
+{
+    return length >= minLength_ && (maxLength_ == 0 || length <= maxLength_);
+}
+
+bool InputFilter::AcceptsNameAndLength(const std::string& name, const int32_t length) const
+{
+    return AcceptsLength(length) && (names_.empty() || names_.count(name) > 0);
+}
+
+bool InputFilter::Accepts(const std::string& name, const int32_t length) const
+{
+    return AcceptsNameAndLength(name, length) && KeepHash(HashString(name), subsample_);
+}
+
+bool InputFilter::Accepts(const BAM::BamRecord& record) const
+{
+    if (!AcceptsNameAndLength(record.FullName(), record.Impl().SequenceLength())) return false;
+    if (minReadQuality_ > 0 &&
+        (!record.HasReadAccuracy() || record.ReadAccuracy() < minReadQuality_))
+        return false;
+    return AcceptsZmw(record);
+}
+
+bool InputFilter::AcceptsZmw(const BAM::BamRecord& record) const
+{
+    if (!zmws_.empty() && (!record.HasHoleNumber() || zmws_.count(record.HoleNumber()) == 0))
+        return false;
+    if (!movies_.empty() && movies_.count(record.MovieName()) == 0) return false;
+    if (subsample_ < 1 || numShards_ > 1) {
+        const uint64_t hash = record.HasHoleNumber()
+                                  ? ZmwHash(HashString(record.MovieName()), record.HoleNumber())
+                                  : HashString(record.FullName());
+        if (!KeepHash(hash, subsample_)) return false;
+        // ranges of records are selected via .pbi
+        if (!shardRows_ && !InShard(hash, shardIndex_, numShards_)) return false;
+    }
+    return true;
+}
+
+bool InputFilter::HasPbi(const std::string& file)
+{
+    const BAM::DataSet ds(file);
+    for (const auto& bamFile : ds.BamFiles())
+        if (!bamFile.PacBioIndexExists()) return false;
+    return true;
+}
+}  // namespace minimap2
+}  // namespace PacBio
@@ -0,0 +1,81 @@
+// Author: Armin Töpfer
+
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <pbbam/BamRecord.h>
+#include <pbbam/PbiFilter.h>
+
+#include "AlignSettings.h"
+
+namespace PacBio {
+namespace minimap2 {
+/// Input read filters provided on the command line. With .pbi files, they are
+/// combined with the dataset filter, such that excluded records are never
+/// decoded; otherwise records are tested after decoding.
+class InputFilter
+{
+public:
+    explicit InputFilter(const AlignSettings& settings);
+
+    bool IsEmpty() const;
+    /// True if a filter needs PacBio tags, which FASTA and FASTQ lack
+    bool UsesPacBioFields() const;
+
+    /// Intersection with the filter of the dataset in file. With zmwOnly,
+    /// only filters that hold for all records of a ZMW are used.
+    BAM::PbiFilter CombinedPbiFilter(const std::string& file, bool zmwOnly = false) const;
+
+    /// Lowers the subsampling fraction such that maxReads of the reads that
+    /// pass all other filters and the shard are kept, spread across the whole
+    /// input. Needs .pbi files and has to follow PlanShards.
+    void SpreadReadCap(int32_t maxReads, const std::vector<std::string>& files);
+
+    /// Splits files into the shards of --shard. BAM files with .pbi files are
+    /// split into contiguous record ranges unless byZmw is set, uncompressed
+    /// FASTA/FASTQ files into byte ranges. Everything else is assigned by a
+    /// hash of movie name and hole number, or of the read name.
+    void PlanShards(const std::vector<std::string>& files, bool byZmw, bool fastx);
+    /// Byte range of the shard in a FASTA/FASTQ file, false if the file has
+    /// to be sharded by read name
+    bool ShardByteRange(const std::string& file, uint64_t* begin, uint64_t* end) const;
+    /// Shard membership by read name, for FASTA/FASTQ
+    bool AcceptsShard(const std::string& name) const;
+
+    bool Accepts(const BAM::BamRecord& record) const;
+    bool Accepts(const std::string& name, int32_t length) const;
+    bool AcceptsLength(int32_t length) const;
+    /// Hole number, movie, subsampling, and shard only
+    bool AcceptsZmw(const BAM::BamRecord& record) const;
+
+    /// True if all BAM files of file have a .pbi file
+    static bool HasPbi(const std::string& file);
+
+private:
+    BAM::PbiFilter ToPbiFilter(const std::string& file, bool zmwOnly) const;
+    bool AcceptsNameAndLength(const std::string& name, int32_t length) const;
+
+private:
+    const int32_t minLength_;
+    const int32_t maxLength_;
+    const double minReadQuality_;
+    std::set<int32_t> zmws_;
+    std::set<std::string> names_;
+    std::set<std::string> movies_;
+    double subsample_;
+
+    const int32_t shardIndex_;
+    const int32_t numShards_;
+    // .pbi file to the shard's rows, if sharded by record ranges
+    std::shared_ptr<const std::map<std::string, std::pair<int64_t, int64_t>>> shardRows_;
+    std::map<std::string, std::pair<uint64_t, uint64_t>> shardBytes_;
+};
+}  // namespace minimap2
+}  // namespace PacBio
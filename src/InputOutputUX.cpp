@@ -1,5 +1,6 @@
 // Author: Armin Töpfer
 
+#include <chrono>
 #include <fstream>
 #include <sstream>
 
@@ -9,6 +10,8 @@
 
 #include "AbortException.h"
 #include "AlignSettings.h"
+#include "InputCatalog.h"
+#include "StreamInput.h"
 
 #include "InputOutputUX.h"
 
@@ -22,7 +25,7 @@ bool InputTypeEquality(const InputType& t0, const InputType& t1)
     if (t1 == InputType::BAM && t0 == InputType::XML_BAM) return true;
     return false;
 }
-InputType DetermineInputFileSuffix(const std::string& inputFile)
+InputType DetermineInputFileSuffix(const std::string& inputFile, InputCatalog& catalog)
 {
     using TypeEnum = BAM::DataSet::TypeEnum;
     if (boost::iends_with(inputFile, "fq") || boost::iends_with(inputFile, "fastq") ||
@@ -36,12 +39,7 @@ InputType DetermineInputFileSuffix(const std::string& inputFile)
     if (boost::iends_with(inputFile, "bam")) return InputType::BAM;
 
     if (boost::iends_with(inputFile, "xml")) {
-        BAM::DataSet dsInput;
-        try {
-            dsInput = BAM::DataSet{inputFile};
-        } catch (...) {
-            throw AbortException(UNKNOWN_FILE_TYPES);
-        }
+        const auto& dsInput = catalog.DataSet(inputFile);
         switch (dsInput.Type()) {
             case TypeEnum::ALIGNMENT:
             case TypeEnum::SUBREAD:
@@ -75,7 +73,7 @@ InputType DetermineFofnContent(const std::string& fofnInputFile, UserIO& uio)
     std::string line;
     while (std::getline(infile, line)) {
         boost::trim(line);
-        const InputType t = DetermineInputFileSuffix(line);
+        const InputType t = DetermineInputFileSuffix(line, *uio.catalog);
         if (!Utility::FileExists(line)) {
             throw AbortException("Input fofn contains non-existing file: " + line);
         }
@@ -128,13 +126,20 @@ std::string InputOutputUX::UnpackJson(const std::string& jsonInputFile)
 
 InputType InputOutputUX::DetermineInputTypeApprox(std::string inputFile, UserIO& uio)
 {
+    const bool follow = uio.isFollowing && boost::iends_with(inputFile, ".bam");
+    if (follow || StreamInput::IsStream(inputFile)) {
+        if (uio.stream) throw AbortException("Only one input can be read from stdin or a pipe.");
+        uio.stream = std::make_shared<StreamInput>(inputFile, follow);
+        return uio.stream->Type();
+    }
     if (!Utility::FileExists(inputFile)) {
         throw AbortException("Input data file does not exist: " + inputFile);
     }
+    if (!uio.catalog) uio.catalog = std::make_shared<InputCatalog>();
     if (boost::iends_with(inputFile, "json")) inputFile = UnpackJson(inputFile);
     if (boost::iends_with(inputFile, "fofn")) return DetermineFofnContent(inputFile, uio);
 
-    return DetermineInputFileSuffix(inputFile);
+    return DetermineInputFileSuffix(inputFile, *uio.catalog);
 }
 
 UserIO InputOutputUX::CheckPositionalArgs(const std::vector<std::string>& args,
@@ -149,6 +154,7 @@ UserIO InputOutputUX::CheckPositionalArgs(const std::vector<std::string>& args,
 
     std::string inputFile;
     std::string referenceFile;
+    uio.isFollowing = settings.Follow;
     const auto file0Type = InputOutputUX::DetermineInputTypeApprox(args[0], uio);
     const auto file1Type = InputOutputUX::DetermineInputTypeApprox(args[1], uio);
 
@@ -270,13 +276,27 @@ UserIO InputOutputUX::CheckPositionalArgs(const std::vector<std::string>& args,
         throw AbortException("Unknown combination");
     }
 
+    PBLOG_INFO << "READ input file: " << inputFile;
+    PBLOG_INFO << "REF  input file: " << referenceFile;
+
+    if (uio.stream) {
+        // reads and reference are both FASTA, only the reads can be streamed
+        if (uio.stream->File() == referenceFile &&
+            IsExactCombination(InputType::FASTA, InputType::FASTA))
+            std::swap(inputFile, referenceFile);
+        if (uio.stream->File() != inputFile)
+            throw AbortException("The reference cannot be read from stdin or a pipe.");
+        uio.isFromStream = true;
+        inputFile = uio.stream->Path();
+    } else if (uio.isFollowing) {
+        throw AbortException("Option --follow requires a BAM file as input.");
+    }
+    if (!uio.catalog) uio.catalog = std::make_shared<InputCatalog>();
+
     if (uio.inputFiles.empty()) {
         uio.inputFiles.emplace_back(inputFile);
     }
 
-    PBLOG_INFO << "READ input file: " << inputFile;
-    PBLOG_INFO << "REF  input file: " << referenceFile;
-
     auto inputFileExt = Utility::FileExtension(inputFile);
     if (inputFileExt == "json") {
         uio.isFromJson = true;
@@ -287,13 +307,10 @@ UserIO InputOutputUX::CheckPositionalArgs(const std::vector<std::string>& args,
     uio.isFromXML = inputFileExt == "xml";
 
     if (!uio.isFastaInput && !uio.isFastqInput) {
-        BAM::DataSet dsInput;
-        try {
-            dsInput = BAM::DataSet{inputFile};
-        } catch (...) {
-            throw AbortException(UNKNOWN_FILE_TYPES);
-        }
-        uio.inputType = dsInput.Type();
+        if (uio.isFromStream)
+            uio.inputType = InputOutputUX::DataSetType(uio.stream->BamReader().Header());
+        else
+            uio.inputType = uio.catalog->DataSet(inputFile).Type();
 
         const auto IsUnrolled = [&]() {
             bool isUnrolled = settings.AlignMode == AlignmentMode::UNROLLED;
@@ -344,7 +361,7 @@ UserIO InputOutputUX::CheckPositionalArgs(const std::vector<std::string>& args,
             default: {
                 std::ostringstream os;
                 os << "Unsupported input data file " << inputFile << " of type "
-                   << BAM::DataSet::TypeToName(dsInput.Type());
+                   << BAM::DataSet::TypeToName(uio.inputType);
                 throw AbortException(os.str());
             }
         }
@@ -356,12 +373,7 @@ UserIO InputOutputUX::CheckPositionalArgs(const std::vector<std::string>& args,
         PBLOG_INFO << "Reference input is an index file. Index parameter override options are "
                       "disabled!";
     } else {
-        BAM::DataSet dsRef;
-        try {
-            dsRef = BAM::DataSet(referenceFile);
-        } catch (...) {
-            throw AbortException(UNKNOWN_FILE_TYPES);
-        }
+        const auto& dsRef = uio.catalog->DataSet(referenceFile);
         if (dsRef.Type() != BAM::DataSet::TypeEnum::REFERENCE) {
             std::ostringstream os;
             os << "ERROR: Unsupported reference input file " << referenceFile << " of type "
@@ -377,7 +389,7 @@ UserIO InputOutputUX::CheckPositionalArgs(const std::vector<std::string>& args,
         reference = fastaFiles.front();
     }
 
-    if (DetermineInputFileSuffix(reference) == InputType::FASTQ) {
+    if (DetermineInputFileSuffix(reference, *uio.catalog) == InputType::FASTQ) {
         throw AbortException("Cannot use FASTQ input as reference. Please use FASTA!");
     }
 
@@ -451,7 +463,13 @@ UserIO InputOutputUX::CheckPositionalArgs(const std::vector<std::string>& args,
             PBLOG_WARN << "Input is not a dataset, but output is. Please use dataset input for "
                           "full SMRT Link compatibility!";
 
-        uio.outPrefix = OutPrefix(uio.outFile);
+        if (settings.MappingOnly) {
+            // PAF is written to the output file itself, any extension is fine
+            uio.outPrefix = uio.outFile;
+            boost::ireplace_last(uio.outPrefix, ".paf", "");
+        } else {
+            uio.outPrefix = OutPrefix(uio.outFile);
+        }
         std::string alnFile = uio.outFile;
         if (uio.isToXML || uio.isToJson) alnFile = uio.outPrefix + ".bam";
 
@@ -527,12 +545,15 @@ std::string InputOutputUX::CreateDataSet(const BAM::DataSet& dsIn, const std::st
     const auto SetFromDatasetInput = [&]() {
         switch (dsIn.Type()) {
             case TypeEnum::SUBREAD:
+            case TypeEnum::ALIGNMENT:
                 SetOutputAlignment();
                 break;
             case TypeEnum::CONSENSUS_READ:
+            case TypeEnum::CONSENSUS_ALIGNMENT:
                 SetOutputConsensus();
                 break;
             case TypeEnum::TRANSCRIPT:
+            case TypeEnum::TRANSCRIPT_ALIGNMENT:
                 SetOutputTranscript();
                 break;
             default:
@@ -590,8 +611,11 @@ std::string InputOutputUX::CreateDataSet(const BAM::DataSet& dsIn, const std::st
             break;
     }
 
-    BAM::ExternalResource refResource("PacBio.ReferenceFile.ReferenceFastaFile", refFile);
-    resource.ExternalResources().Add(refResource);
+    // merged inputs may not name their reference
+    if (!refFile.empty()) {
+        BAM::ExternalResource refResource("PacBio.ReferenceFile.ReferenceFastaFile", refFile);
+        resource.ExternalResources().Add(refResource);
+    }
     ds.ExternalResources().Add(resource);
     std::string name;
     if (hasName)
@@ -614,6 +638,68 @@ std::string InputOutputUX::CreateDataSet(const BAM::DataSet& dsIn, const std::st
     return outputDSFileName;
 }
 
+BAM::DataSet::TypeEnum InputOutputUX::DataSetType(const BAM::BamHeader& header)
+{
+    using TypeEnum = BAM::DataSet::TypeEnum;
+    const bool aligned = !header.Sequences().empty();
+    for (const auto& rg : header.ReadGroups()) {
+        if (rg.ReadType() == "CCS")
+            return aligned ? TypeEnum::CONSENSUS_ALIGNMENT : TypeEnum::CONSENSUS_READ;
+        if (rg.ReadType() == "TRANSCRIPT")
+            return aligned ? TypeEnum::TRANSCRIPT_ALIGNMENT : TypeEnum::TRANSCRIPT;
+    }
+    return aligned ? TypeEnum::ALIGNMENT : TypeEnum::SUBREAD;
+}
+
+void InputOutputUX::WriteDatastore(const std::string& jsonFile, const BAM::DataSet::TypeEnum type,
+                                   const std::string& sourceId,
+                                   const std::vector<std::string>& bamFiles,
+                                   const std::vector<std::string>& xmlNames,
+                                   const std::vector<std::string>& ids)
+{
+    JSON::Json datastore;
+    const auto now = BAM::ToIso8601(std::chrono::system_clock::now());
+    datastore["createdAt"] = now;
+    datastore["updatedAt"] = now;
+    datastore["version"] = "0.2.2";
+    std::vector<JSON::Json> files;
+    for (size_t i = 0; i < bamFiles.size(); ++i) {
+        JSON::Json datastoreFile;
+        datastoreFile["createdAt"] = now;
+        datastoreFile["description"] = "Aligned and sorted reads as BAM";
+        std::ifstream file(bamFiles[i], std::ios::binary | std::ios::ate);
+        datastoreFile["fileSize"] = static_cast<int>(file.tellg());
+
+        switch (type) {
+            case BAM::DataSet::TypeEnum::SUBREAD:
+            case BAM::DataSet::TypeEnum::ALIGNMENT:
+                datastoreFile["fileTypeId"] = "PacBio.DataSet.AlignmentSet";
+                break;
+            case BAM::DataSet::TypeEnum::CONSENSUS_READ:
+            case BAM::DataSet::TypeEnum::CONSENSUS_ALIGNMENT:
+                datastoreFile["fileTypeId"] = "PacBio.DataSet.ConsensusAlignmentSet";
+                break;
+            case BAM::DataSet::TypeEnum::TRANSCRIPT:
+            case BAM::DataSet::TypeEnum::TRANSCRIPT_ALIGNMENT:
+                datastoreFile["fileTypeId"] = "PacBio.DataSet.TranscriptAlignmentSet";
+                break;
+            default:
+                throw std::runtime_error("Unsupported input type");
+        }
+
+        datastoreFile["isChunked"] = false;
+        datastoreFile["modifiedAt"] = now;
+        datastoreFile["name"] = "Aligned reads";
+        datastoreFile["path"] = xmlNames[i];
+        datastoreFile["sourceId"] = sourceId;
+        datastoreFile["uniqueId"] = ids[i];
+        files.emplace_back(datastoreFile);
+    }
+    datastore["files"] = files;
+    std::ofstream datastoreStream(jsonFile);
+    datastoreStream << datastore.dump(2);
+}
+
 std::string InputOutputUX::OutPrefix(const std::string& outputFile)
 {
     // Check if output type is a dataset
@@ -2,11 +2,13 @@
 
 #pragma once
 
+#include <memory>
 #include <string>
 #include <vector>
 
 #include <BamIndex.h>
 
+#include <pbbam/BamHeader.h>
 #include <pbbam/DataSet.h>
 #include <pbcopper/json/JSON.h>
 
@@ -19,6 +21,8 @@ static const std::string UNKNOWN_FILE_TYPES =
 }
 
 struct AlignSettings;
+class InputCatalog;
+class StreamInput;
 
 enum class InputType : int
 {
@@ -56,9 +60,15 @@ struct UserIO
     bool isFromConsensuReadSet = false;
     bool isFromTranscriptSet = false;
     bool isFromMmi = false;
+    bool isFromStream = false;
+    bool isFollowing = false;
     BAM::DataSet::TypeEnum inputType;
     std::vector<std::string> inputFiles;
     BamIndex bamIndex = BamIndex::NONE;
+    // datasets and BAM headers of the inputs, each parsed once
+    std::shared_ptr<InputCatalog> catalog;
+    // stdin, a pipe, or a followed BAM, inputFiles holds the path of its replay pipe
+    std::shared_ptr<StreamInput> stream;
 };
 
 class InputOutputUX
@@ -87,6 +97,16 @@ public:
                                      const BamIndex& bamIndex = BamIndex::NONE);
 
     static std::string OutPrefix(const std::string& outputFile);
+
+    // BAM input without dataset, its read groups tell the read type
+    static BAM::DataSet::TypeEnum DataSetType(const BAM::BamHeader& header);
+
+    // Datastore JSON that lists one dataset XML per BAM file
+    static void WriteDatastore(const std::string& jsonFile, BAM::DataSet::TypeEnum type,
+                               const std::string& sourceId,
+                               const std::vector<std::string>& bamFiles,
+                               const std::vector<std::string>& xmlNames,
+                               const std::vector<std::string>& ids);
 };
 }  // namespace minimap2
 }  // namespace PacBio
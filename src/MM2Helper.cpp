@@ -2,6 +2,7 @@
 
 #include <pbmm2/MM2Helper.h>
 
+#include <algorithm>
 #include <fstream>
 #include <iostream>
 #include <memory>
@@ -18,6 +19,8 @@
 #include <pbcopper/utility/FileUtils.h>
 
 #include "AbortException.h"
+#include "PerfCounters.h"
+#include "SequenceKernels.h"
 
 using namespace std::literals::string_literals;
 
@@ -108,6 +111,239 @@ Data::Cigar RenderCigar(const mm_reg1_t* const r, const int qlen, const int opt_
 
     return cigar;
 }
+
+Data::Cigar RenderCigar(const WindowHit& hit, const int qlen, const int opt_flag)
+{
+    using Data::Cigar;
+
+    Cigar cigar;
+
+    if (!hit.IsMapped) return cigar;
+
+    uint32_t clip_len[2];
+    clip_len[0] = hit.Reverse ? qlen - hit.QueryEnd : hit.QueryStart;
+    clip_len[1] = hit.Reverse ? hit.QueryStart : qlen - hit.QueryEnd;
+    const char clip_char = !(opt_flag & MM_F_SOFTCLIP) ? 'H' : 'S';
+
+    if (clip_len[0]) cigar.emplace_back(clip_char, clip_len[0]);
+    for (const auto c : hit.Cigar)
+        cigar.emplace_back("MIDNSHP=XB"[c & 0xf], c >> 4);
+    if (clip_len[1]) cigar.emplace_back(clip_char, clip_len[1]);
+
+    return cigar;
+}
+
+// Operation counts behind the mc, mi, and mg tags
+struct CigarCounts
+{
+    int32_t Match = 0;
+    int32_t Mismatch = 0;
+    int32_t Ins = 0;
+    int32_t Del = 0;
+    int32_t InsEvents = 0;
+    int32_t DelEvents = 0;
+
+    void Add(const Data::CigarOperationType type, const int32_t len)
+    {
+        switch (type) {
+            case Data::CigarOperationType::INSERTION:
+                Ins += len;
+                ++InsEvents;
+                break;
+            case Data::CigarOperationType::DELETION:
+                Del += len;
+                ++DelEvents;
+                break;
+            case Data::CigarOperationType::SEQUENCE_MISMATCH:
+                Mismatch += len;
+                break;
+            case Data::CigarOperationType::REFERENCE_SKIP:
+                break;
+            case Data::CigarOperationType::SEQUENCE_MATCH:
+            case Data::CigarOperationType::ALIGNMENT_MATCH:
+                Match += len;
+                break;
+            case Data::CigarOperationType::PADDING:
+            case Data::CigarOperationType::SOFT_CLIP:
+            case Data::CigarOperationType::HARD_CLIP:
+                break;
+            case Data::CigarOperationType::UNKNOWN_OP:
+            default:
+                throw AbortException("UNKNOWN OP");
+                break;
+        }
+    }
+
+    static CigarCounts FromCigar(const Data::Cigar& cigar)
+    {
+        CigarCounts counts;
+        for (const auto& op : cigar)
+            counts.Add(op.Type(), op.Length());
+        return counts;
+    }
+
+    // minimap2 encoding, length << 4 | op, with ops in BAM order
+    static CigarCounts FromRaw(const uint32_t* cigar, const uint32_t n)
+    {
+        CigarCounts counts;
+        for (uint32_t i = 0; i < n; ++i)
+            counts.Add(static_cast<Data::CigarOperationType>(cigar[i] & 0xf), cigar[i] >> 4);
+        return counts;
+    }
+
+    int32_t NumAlignedBases() const { return Match + Ins + Mismatch; }
+
+    double Concordance(const int32_t span) const
+    {
+        return boost::algorithm::clamp(100 * (1.0 - 1.0 * (Ins + Del + Mismatch) / span), 0.0,
+                                       100.0);
+    }
+    double Identity() const { return 100.0 * Match / (Match + Mismatch + Del + Ins); }
+    double IdentityGapComp() const
+    {
+        return 100.0 * Match / (Match + Mismatch + DelEvents + InsEvents);
+    }
+};
+
+// Same arithmetic as AlignedRecordImpl, so that the FilterFunc would reject
+// every alignment that fails here
+bool PassesThresholds(const AlignmentThresholds& thresholds, const CigarCounts& counts)
+{
+    const int32_t span = counts.NumAlignedBases();
+    if (span < thresholds.MinSpan) return false;
+    if (span <= 0) return true;
+    return counts.Concordance(span) >= thresholds.MinPercConcordance &&
+           counts.Identity() >= thresholds.MinPercIdentity &&
+           counts.IdentityGapComp() >= thresholds.MinPercIdentityGapComp;
+}
+
+// Window alignment with query coordinates in reference direction
+struct StitchPiece
+{
+    int32_t QueryStart;
+    int32_t QueryEnd;
+    int32_t RefStart;
+    int32_t RefEnd;
+    std::vector<uint32_t> Cigar;
+};
+
+bool ConsumesQuery(const uint32_t op) { return op == 0 || op == 1 || op == 7 || op == 8; }
+bool ConsumesRef(const uint32_t op) { return op == 0 || op == 2 || op == 3 || op == 7 || op == 8; }
+bool IsMatchOp(const uint32_t op) { return op == 0 || op == 7 || op == 8; }
+
+void AppendCigarOp(std::vector<uint32_t>* cigar, const uint32_t op, const uint32_t len)
+{
+    if (!cigar->empty() && (cigar->back() & 0xf) == op)
+        cigar->back() += len << 4;
+    else
+        cigar->emplace_back(len << 4 | op);
+}
+
+// Keeps the part of the piece within [queryBegin, queryEnd) that starts at or
+// after refBegin, flanked by matches. Returns false if nothing is left.
+bool ClipPiece(StitchPiece* piece, const int32_t queryBegin, const int32_t queryEnd,
+               const int32_t refBegin)
+{
+    std::vector<uint32_t> cigar;
+    int32_t q = piece->QueryStart;
+    int32_t r = piece->RefStart;
+    for (const auto c : piece->Cigar) {
+        const uint32_t op = c & 0xf;
+        const bool cq = ConsumesQuery(op);
+        const bool cr = ConsumesRef(op);
+        for (uint32_t l = 0; l < (c >> 4); ++l) {
+            const bool keep = q >= queryBegin && q < queryEnd && r >= refBegin;
+            // a flanking indel or skip is dropped below anyway
+            if (keep && (!cigar.empty() || IsMatchOp(op))) {
+                if (cigar.empty()) {
+                    piece->QueryStart = q;
+                    piece->RefStart = r;
+                }
+                AppendCigarOp(&cigar, op, 1);
+            }
+            q += cq;
+            r += cr;
+        }
+    }
+    while (!cigar.empty() && !IsMatchOp(cigar.back() & 0xf))
+        cigar.pop_back();
+    if (cigar.empty()) return false;
+
+    piece->Cigar = std::move(cigar);
+    piece->QueryEnd = piece->QueryStart;
+    piece->RefEnd = piece->RefStart;
+    for (const auto c : piece->Cigar) {
+        if (ConsumesQuery(c & 0xf)) piece->QueryEnd += c >> 4;
+        if (ConsumesRef(c & 0xf)) piece->RefEnd += c >> 4;
+    }
+    return true;
+}
+
+// Chains window alignments into one alignment of the full read. Each window
+// owns the read up to the middle of its overlaps with the neighbors. Windows
+// must map to the same reference and strand, and joins may neither go
+// backwards nor leave gaps longer than maxGap.
+boost::optional<WindowHit> StitchWindowHits(const std::vector<ReadWindow>& windows,
+                                            const std::vector<WindowHit>& hits, const int32_t qlen,
+                                            const int32_t maxGap)
+{
+    if (hits.empty() || hits.size() != windows.size()) return boost::none;
+    const auto& first = hits.front();
+    const bool rev = first.Reverse;
+    const auto ToAligned = [&](const int32_t pos) { return rev ? qlen - pos : pos; };
+
+    std::vector<StitchPiece> pieces;
+    uint8_t mapq = 255;
+    for (size_t i = 0; i < hits.size(); ++i) {
+        const auto& hit = hits[i];
+        if (!hit.IsMapped || hit.RefId != first.RefId || hit.Reverse != rev) return boost::none;
+        const int32_t ownBegin = i == 0 ? 0 : (windows[i].Begin + windows[i - 1].End) / 2;
+        const int32_t ownEnd =
+            i + 1 == windows.size() ? qlen : (windows[i + 1].Begin + windows[i].End) / 2;
+        StitchPiece piece{std::min(ToAligned(hit.QueryStart), ToAligned(hit.QueryEnd)),
+                          std::max(ToAligned(hit.QueryStart), ToAligned(hit.QueryEnd)),
+                          hit.RefStart, hit.RefEnd, hit.Cigar};
+        if (ClipPiece(&piece, std::min(ToAligned(ownBegin), ToAligned(ownEnd)),
+                      std::max(ToAligned(ownBegin), ToAligned(ownEnd)), piece.RefStart))
+            pieces.emplace_back(std::move(piece));
+        mapq = std::min(mapq, hit.MapQuality);
+    }
+    if (pieces.empty()) return boost::none;
+    std::sort(pieces.begin(), pieces.end(), [](const StitchPiece& l, const StitchPiece& r) {
+        return l.QueryStart < r.QueryStart;
+    });
+
+    WindowHit result;
+    result.IsMapped = true;
+    result.RefId = first.RefId;
+    result.Reverse = rev;
+    result.MapQuality = mapq;
+    result.RefStart = pieces.front().RefStart;
+    for (size_t i = 0; i < pieces.size(); ++i) {
+        auto& piece = pieces[i];
+        if (i > 0) {
+            const auto& prev = pieces[i - 1];
+            // small reference overlaps at the join are resolved in favor of prev
+            if (piece.RefStart < prev.RefEnd) {
+                const int32_t queryStart = piece.QueryStart;
+                if (!ClipPiece(&piece, piece.QueryStart, piece.QueryEnd, prev.RefEnd) ||
+                    piece.QueryStart - queryStart > maxGap)
+                    return boost::none;
+            }
+            const int32_t queryGap = piece.QueryStart - prev.QueryEnd;
+            const int32_t refGap = piece.RefStart - prev.RefEnd;
+            if (queryGap < 0 || queryGap > maxGap || refGap > maxGap) return boost::none;
+            if (queryGap > 0) AppendCigarOp(&result.Cigar, 1, queryGap);
+            if (refGap > 0) AppendCigarOp(&result.Cigar, 2, refGap);
+        }
+        for (const auto c : piece.Cigar)
+            AppendCigarOp(&result.Cigar, c & 0xf, c >> 4);
+    }
+    result.RefEnd = pieces.back().RefEnd;
+    result.QueryStart = rev ? qlen - pieces.back().QueryEnd : pieces.front().QueryStart;
+    result.QueryEnd = rev ? qlen - pieces.front().QueryStart : pieces.back().QueryEnd;
+    return result;
+}
 }  // namespace
 
 MM2Helper::MM2Helper(const std::string& refs, const MM2Settings& settings,
@@ -116,6 +352,9 @@ MM2Helper::MM2Helper(const std::string& refs, const MM2Settings& settings,
     , alnMode_(settings.AlignMode)
     , trimRepeatedMatches_(!settings.NoTrimming)
     , maxNumAlns_(settings.MaxNumAlns)
+    , windowSize_(settings.WindowSize)
+    , thresholds_(settings.Thresholds)
+    , outputUnmapped_(settings.OutputUnmapped)
 {
     std::string preset;
     PreInit(settings, &preset);
@@ -128,6 +367,9 @@ MM2Helper::MM2Helper(const std::vector<BAM::FastaSequence>& refs, const MM2Setti
     , alnMode_(settings.AlignMode)
     , trimRepeatedMatches_(!settings.NoTrimming)
     , maxNumAlns_(settings.MaxNumAlns)
+    , windowSize_(settings.WindowSize)
+    , thresholds_(settings.Thresholds)
+    , outputUnmapped_(settings.OutputUnmapped)
 {
     std::string preset;
     PreInit(settings, &preset);
@@ -140,6 +382,9 @@ MM2Helper::MM2Helper(std::vector<BAM::FastaSequence>&& refs, const MM2Settings&
     , alnMode_(settings.AlignMode)
     , trimRepeatedMatches_(!settings.NoTrimming)
     , maxNumAlns_(settings.MaxNumAlns)
+    , windowSize_(settings.WindowSize)
+    , thresholds_(settings.Thresholds)
+    , outputUnmapped_(settings.OutputUnmapped)
 {
     std::string preset;
     PreInit(settings, &preset);
@@ -179,7 +424,7 @@ void MM2Helper::PreInit(const MM2Settings& settings, std::string* preset)
     IdxOpts.batch_size = 0x7fffffffffffffffL;  // always build a uni-part index
 
     mm_mapopt_init(&MapOpts);
-    MapOpts.flag |= MM_F_CIGAR;
+    if (!settings.MappingOnly) MapOpts.flag |= MM_F_CIGAR;
     MapOpts.flag |= MM_F_SOFTCLIP;
     MapOpts.flag |= MM_F_LONG_CIGAR;
     MapOpts.flag |= MM_F_EQX;
@@ -355,9 +600,15 @@ bool checkIsSupplementaryAlignment(const BAM::BamRecord& record)
 
 bool checkIsSupplementaryAlignment(const Data::Read&) { return false; }
 
+bool checkIsSupplementaryAlignment(const FastxRecord&) { return false; }
+
 std::string getNativeOrientationSequence(const BAM::BamRecord& record)
 {
-    return record.Sequence(BAM::Orientation::NATIVE);
+    // decode once and flip in place, instead of BamRecord::Sequence(NATIVE)
+    // with its orientation and clipping handling and scalar reverse complement
+    std::string seq = record.Impl().Sequence();
+    if (record.Impl().IsReverseStrand()) SequenceKernels::ReverseComplement(&seq);
+    return seq;
 }
 
 const std::string& getNativeOrientationSequence(const Data::Read& record)
@@ -366,63 +617,142 @@ const std::string& getNativeOrientationSequence(const Data::Read& record)
     return record.Seq;
 }
 
+const std::string& getNativeOrientationSequence(const FastxRecord& record) { return record.Bases; }
+
+// Type of the unaligned record that alignments are built from
+template <typename In>
+struct UnalignedType
+{
+    using Type = In;
+};
+
+template <>
+struct UnalignedType<FastxRecord>
+{
+    using Type = BAM::BamRecord;
+};
+
 std::unique_ptr<BAM::BamRecord> createUnalignedCopy(const BAM::BamRecord& record,
                                                     const std::string& seq)
 {
     std::unique_ptr<BAM::BamRecord> unalignedCopy;
     if (record.IsMapped()) {
+        // copy the raw record in one block and reset the mapping fields in place,
+        // name and tags are kept as they are
         unalignedCopy = std::make_unique<BAM::BamRecord>(record.Header());
-        unalignedCopy->Impl().SetSequenceAndQualities(
-            seq, record.Qualities(BAM::Orientation::NATIVE).Fastq());
-        unalignedCopy->Impl().SetReverseStrand(false);
-        unalignedCopy->Impl().SetMapped(false);
-        unalignedCopy->Impl().CigarData(Data::Cigar{});
-        for (const auto& tag : record.Impl().Tags())
-            if (tag.first != "RG") unalignedCopy->Impl().AddTag(tag.first, tag.second);
-        unalignedCopy->ReadGroupId(record.ReadGroupId());
-        unalignedCopy->Impl().Name(record.FullName());
+        auto& impl = unalignedCopy->Impl();
+        impl = record.Impl();
+        if (impl.IsReverseStrand())
+            impl.SetSequenceAndQualities(seq, record.Qualities(BAM::Orientation::NATIVE).Fastq());
+        impl.Flag(0);
+        impl.SetMapped(false);
+        impl.ReferenceId(-1);
+        impl.Position(-1);
+        impl.MapQuality(255);
+        impl.MateReferenceId(-1);
+        impl.MatePosition(-1);
+        impl.InsertSize(0);
+        impl.CigarData(Data::Cigar{});
     }
     return unalignedCopy;
 }
 
-std::unique_ptr<Data::Read> createUnalignedCopy(const Data::Read&, const std::string&)
+// Mapped input is only copied once a record has to be built from it
+const BAM::BamRecord& unalignedBase(const BAM::BamRecord& record, const std::string& seq,
+                                    std::unique_ptr<BAM::BamRecord>& unalignedCopy)
 {
-    return nullptr;
+    if (!record.IsMapped()) return record;
+    if (!unalignedCopy) unalignedCopy = createUnalignedCopy(record, seq);
+    return *unalignedCopy;
 }
 
+const Data::Read& unalignedBase(const Data::Read& record, const std::string&,
+                                std::unique_ptr<Data::Read>&)
+{
+    return record;
+}
+
+// FASTX reads are only encoded once the first alignment is built
+const BAM::BamRecord& unalignedBase(const FastxRecord& record, const std::string&,
+                                    std::unique_ptr<BAM::BamRecord>& unalignedCopy)
+{
+    if (!unalignedCopy) unalignedCopy = std::make_unique<BAM::BamRecord>(record.ToBam());
+    return *unalignedCopy;
+}
+
+// Reverse strand sequence and qualities of one read, computed on first use
+// and shared by all of its reverse strand alignments
+struct ReverseStrandCache
+{
+    bool Filled = false;
+    std::string Sequence;
+    std::string Qualities;
+};
+
 BAM::BamRecord Mapped(const BAM::BamRecord& record, int32_t refId, Data::Position refStart,
-                      Data::Strand strand, Data::Cigar cigar, uint8_t mapq)
+                      Data::Strand strand, Data::Cigar cigar, uint8_t mapq,
+                      ReverseStrandCache* reverse)
 {
-    return BAM::BamRecord::Mapped(record, refId, refStart, strand, std::move(cigar), mapq);
+    if (strand == Data::Strand::FORWARD)
+        return BAM::BamRecord::Mapped(record, refId, refStart, strand, std::move(cigar), mapq);
+
+    // record is unmapped, its sequence is in native orientation
+    if (!reverse->Filled) {
+        reverse->Sequence = record.Impl().Sequence();
+        reverse->Qualities = record.Impl().Qualities().Fastq();
+        SequenceKernels::ReverseComplement(&reverse->Sequence);
+        SequenceKernels::Reverse(&reverse->Qualities);
+        reverse->Filled = true;
+    }
+    // map as forward to skip pbbam's per-record reverse complement
+    auto mapped = BAM::BamRecord::Mapped(record, refId, refStart, Data::Strand::FORWARD,
+                                         std::move(cigar), mapq);
+    mapped.Impl().SetReverseStrand(true);
+    mapped.Impl().SetSequenceAndQualities(reverse->Sequence, reverse->Qualities);
+    return mapped;
 }
 
 CompatMappedRead Mapped(const Data::Read& record, int32_t refId, Data::Position refStart,
-                        Data::Strand strand, Data::Cigar cigar, uint8_t mapq)
+                        Data::Strand strand, Data::Cigar cigar, uint8_t mapq, ReverseStrandCache*)
 {
     return CompatMappedRead{Data::MappedRead{record, strand, refStart, std::move(cigar), mapq},
                             refId};
 }
 
+// unaligned input records are only copied if they are written
 void postprocess(std::vector<AlignedRecord>& localResults,
-                 std::unique_ptr<BAM::BamRecord>& unalignedCopy, const BAM::BamRecord& record)
+                 std::unique_ptr<BAM::BamRecord>& unalignedCopy, const BAM::BamRecord& record,
+                 const std::string& seq, const bool outputUnmapped)
 {
-    if (localResults.empty()) {
-        if (record.IsMapped()) {
-            const auto RemovePbmm2MappedTags = [](BAM::BamRecord& r) {
-                for (const auto& t : {"SA", "rm", "mc", "mi", "mg"})
-                    r.Impl().RemoveTag(t);
-            };
-            if (unalignedCopy) {
-                RemovePbmm2MappedTags(*unalignedCopy);
-                localResults.emplace_back(*unalignedCopy);
-            }
-        } else {
-            localResults.emplace_back(AlignedRecord{record});
-        }
+    if (!localResults.empty() || !outputUnmapped) return;
+    if (record.IsMapped()) {
+        const auto RemovePbmm2MappedTags = [](BAM::BamRecord& r) {
+            for (const auto& t : {"SA", "rm", "mc", "mi", "mg"})
+                r.Impl().RemoveTag(t);
+        };
+        if (!unalignedCopy) unalignedCopy = createUnalignedCopy(record, seq);
+        RemovePbmm2MappedTags(*unalignedCopy);
+        localResults.emplace_back(std::move(*unalignedCopy));
+    } else {
+        localResults.emplace_back(AlignedRecord{record});
     }
 }
 
-void postprocess(std::vector<AlignedRead>&, std::unique_ptr<Data::Read>&, const Data::Read&) {}
+void postprocess(std::vector<AlignedRead>&, std::unique_ptr<Data::Read>&, const Data::Read&,
+                 const std::string&, bool)
+{}
+
+// unmapped FASTX reads are only encoded if they are written
+void postprocess(std::vector<AlignedRecord>& localResults,
+                 std::unique_ptr<BAM::BamRecord>& unalignedCopy, const FastxRecord& record,
+                 const std::string&, const bool outputUnmapped)
+{
+    if (!localResults.empty() || !outputUnmapped) return;
+    if (unalignedCopy)
+        localResults.emplace_back(std::move(*unalignedCopy));
+    else
+        localResults.emplace_back(record.ToBam());
+}
 
 }  // namespace
 
@@ -467,11 +797,16 @@ std::vector<Out> MM2Helper::AlignImpl(const In& record,
     int numAlns;
     // watch out for lifetime issues when changing from const-ref to ref
     const auto& seq = getNativeOrientationSequence(record);
-    std::unique_ptr<In> unalignedCopy = createUnalignedCopy(record, seq);
+    std::unique_ptr<typename UnalignedType<In>::Type> unalignedCopy;
+    ReverseStrandCache reverse;
 
     const int qlen = seq.length();
-    auto alns = mm_map(Idx->idx_, qlen, seq.c_str(), &numAlns,
-                       tbufLocal ? tbufLocal->tbuf_ : tbuf->tbuf_, &MapOpts, nullptr);
+    mm_reg1_t* alns;
+    {
+        const PerfScope perf{PerfStage::MAP};
+        alns = mm_map(Idx->idx_, qlen, seq.c_str(), &numAlns,
+                      tbufLocal ? tbufLocal->tbuf_ : tbuf->tbuf_, &MapOpts, nullptr);
+    }
 
     std::vector<int> used;
     std::vector<int32_t> queryHits(seq.size(), 0);
@@ -676,21 +1011,30 @@ std::vector<Out> MM2Helper::AlignImpl(const In& record,
         int begin = trim ? 0 : aln.qs;
         int end = trim ? 0 : aln.qe;
         if (trim && !SetQryHits(aln, &begin, &end)) return;
+        // reject before the CIGAR is rendered and the record is built
+        if (!trim && aln.p &&
+            !PassesThresholds(thresholds_, CigarCounts::FromRaw(aln.p->cigar, aln.p->n_cigar)))
+            return;
         const int32_t refId = aln.rid;
         const Data::Strand strand = aln.rev ? Data::Strand::REVERSE : Data::Strand::FORWARD;
         int refStartOffset = 0;
         Data::Cigar cigar;
-        if (trim)
+        if (trim) {
             cigar = RenderCigar(&aln, qlen, MapOpts.flag, begin, end, &refStartOffset);
-        else
+            if (!PassesThresholds(thresholds_, CigarCounts::FromCigar(cigar))) return;
+        } else {
             cigar = RenderCigar(&aln, qlen, MapOpts.flag);
+        }
         const Data::Position refStart = aln.rs + refStartOffset;
 
-        auto mapped = Mapped(unalignedCopy ? *unalignedCopy : record, refId, refStart, strand,
-                             std::move(cigar), aln.mapq);
-        mapped.Impl().RemoveTag("rm");
-        mapped.Impl().SetSupplementaryAlignment(aln.sam_pri == 0);
-        Out alnRec{std::move(mapped)};
+        Out alnRec = [&]() {
+            const PerfScope perf{PerfStage::RECORD};
+            auto mapped = Mapped(unalignedBase(record, seq, unalignedCopy), refId, refStart, strand,
+                                 std::move(cigar), aln.mapq, &reverse);
+            mapped.Impl().RemoveTag("rm");
+            mapped.Impl().SetSupplementaryAlignment(aln.sam_pri == 0);
+            return Out{std::move(mapped)};
+        }();
         if (filter(alnRec)) localResults.emplace_back(std::move(alnRec));
     };
 
@@ -822,11 +1166,172 @@ std::vector<Out> MM2Helper::AlignImpl(const In& record,
         if (alns[i].p) free(alns[i].p);
     free(alns);
 
-    postprocess(localResults, unalignedCopy, record);
+    postprocess(localResults, unalignedCopy, record, seq, outputUnmapped_);
+
+    return localResults;
+}
+
+std::vector<ReadWindow> MM2Helper::SplitIntoWindows(const int32_t readLength) const
+{
+    std::vector<ReadWindow> windows;
+    // only UNROLLED reads are aligned as one collinear chain
+    if (windowSize_ <= 0 || alnMode_ != AlignmentMode::UNROLLED || enforcedMapping_ ||
+        readLength < 2 * windowSize_)
+        return windows;
+
+    // equally sized windows, no longer than windowSize_
+    const int32_t overlap = windowSize_ / 10;
+    const int64_t span = readLength - overlap;
+    const int64_t step = windowSize_ - overlap;
+    const int32_t numWindows = (span + step - 1) / step;
+    for (int32_t i = 0; i < numWindows; ++i) {
+        const int32_t begin = span * i / numWindows;
+        const int32_t end = span * (i + 1) / numWindows + overlap;
+        windows.emplace_back(ReadWindow{begin, end});
+    }
+    return windows;
+}
+
+WindowHit MM2Helper::MapWindow(const std::string& seq, const ReadWindow& window,
+                               std::unique_ptr<ThreadBuffer>& tbuf) const
+{
+    if (!tbuf) tbuf = std::make_unique<ThreadBuffer>();
+
+    int numAlns;
+    mm_reg1_t* alns;
+    {
+        const PerfScope perf{PerfStage::MAP};
+        alns = mm_map(Idx->idx_, window.End - window.Begin, seq.c_str() + window.Begin, &numAlns,
+                      tbuf->tbuf_, &MapOpts, nullptr);
+    }
+
+    WindowHit hit;
+    for (int i = 0; i < numAlns; ++i) {
+        const auto& aln = alns[i];
+        if (aln.p == nullptr || aln.id != aln.parent) continue;
+        hit.IsMapped = true;
+        hit.RefId = aln.rid;
+        hit.Reverse = aln.rev;
+        hit.QueryStart = window.Begin + aln.qs;
+        hit.QueryEnd = window.Begin + aln.qe;
+        hit.RefStart = aln.rs;
+        hit.RefEnd = aln.re;
+        hit.MapQuality = aln.mapq;
+        hit.Cigar.assign(aln.p->cigar, aln.p->cigar + aln.p->n_cigar);
+        break;
+    }
+
+    // cleanup
+    for (int i = 0; i < numAlns; ++i)
+        if (alns[i].p) free(alns[i].p);
+    free(alns);
+
+    return hit;
+}
+
+std::vector<AlignedRecord> MM2Helper::StitchWindows(const BAM::BamRecord& record,
+                                                    const std::vector<ReadWindow>& windows,
+                                                    const std::vector<WindowHit>& hits,
+                                                    const FilterFunc& filter,
+                                                    std::unique_ptr<ThreadBuffer>& tbuf) const
+{
+    if (checkIsSupplementaryAlignment(record)) return {};
+    return StitchWindows(record, getNativeOrientationSequence(record), windows, hits, filter, tbuf);
+}
+
+std::vector<AlignedRecord> MM2Helper::StitchWindows(const BAM::BamRecord& record,
+                                                    const std::string& seq,
+                                                    const std::vector<ReadWindow>& windows,
+                                                    const std::vector<WindowHit>& hits,
+                                                    const FilterFunc& filter,
+                                                    std::unique_ptr<ThreadBuffer>& tbuf) const
+{
+    std::vector<AlignedRecord> localResults;
+    if (checkIsSupplementaryAlignment(record)) return localResults;
+
+    const int qlen = seq.length();
+    std::unique_ptr<BAM::BamRecord> unalignedCopy;
+
+    if (std::none_of(hits.cbegin(), hits.cend(), [](const WindowHit& h) { return h.IsMapped; })) {
+        postprocess(localResults, unalignedCopy, record, seq, outputUnmapped_);
+        return localResults;
+    }
+
+    const auto stitched = StitchWindowHits(windows, hits, qlen, windowSize_ / 10);
+    if (!stitched) {
+        PBLOG_DEBUG << "Windows of " << record.FullName()
+                    << " are not collinear, aligning full read";
+        return Align(record, filter, tbuf);
+    }
+
+    if (!PassesThresholds(thresholds_,
+                          CigarCounts::FromRaw(stitched->Cigar.data(), stitched->Cigar.size()))) {
+        postprocess(localResults, unalignedCopy, record, seq, outputUnmapped_);
+        return localResults;
+    }
+
+    ReverseStrandCache reverse;
+    AlignedRecord alnRec = [&]() {
+        const PerfScope perf{PerfStage::RECORD};
+        auto mapped =
+            Mapped(unalignedBase(record, seq, unalignedCopy), stitched->RefId, stitched->RefStart,
+                   stitched->Reverse ? Data::Strand::REVERSE : Data::Strand::FORWARD,
+                   RenderCigar(*stitched, qlen, MapOpts.flag), stitched->MapQuality, &reverse);
+        mapped.Impl().RemoveTag("rm");
+        mapped.Impl().SetSupplementaryAlignment(false);
+        return AlignedRecord{std::move(mapped)};
+    }();
+    if (filter(alnRec)) localResults.emplace_back(std::move(alnRec));
+
+    postprocess(localResults, unalignedCopy, record, seq, outputUnmapped_);
 
     return localResults;
 }
 
+std::vector<MappingHit> MM2Helper::Map(const BAM::BamRecord& record,
+                                       std::unique_ptr<ThreadBuffer>& tbuf) const
+{
+    std::vector<MappingHit> hits;
+    if (checkIsSupplementaryAlignment(record)) return hits;
+    if (!tbuf) tbuf = std::make_unique<ThreadBuffer>();
+
+    const auto seq = getNativeOrientationSequence(record);
+    int numAlns;
+    mm_reg1_t* alns;
+    {
+        const PerfScope perf{PerfStage::MAP};
+        alns =
+            mm_map(Idx->idx_, seq.length(), seq.c_str(), &numAlns, tbuf->tbuf_, &MapOpts, nullptr);
+    }
+
+    for (int i = 0; i < numAlns; ++i) {
+        const auto& aln = alns[i];
+        // secondary chain
+        if (aln.id != aln.parent) continue;
+        if (maxNumAlns_ > 0 && static_cast<int32_t>(hits.size()) >= maxNumAlns_) break;
+        MappingHit hit;
+        hit.RefId = aln.rid;
+        hit.Reverse = aln.rev;
+        hit.QueryStart = aln.qs;
+        hit.QueryEnd = aln.qe;
+        hit.RefStart = aln.rs;
+        hit.RefEnd = aln.re;
+        hit.NumMatches = aln.mlen;
+        hit.BlockLength = aln.blen;
+        hit.NumMinimizers = aln.cnt;
+        hit.ChainScore = aln.score;
+        hit.MapQuality = aln.mapq;
+        hits.emplace_back(hit);
+    }
+
+    // cleanup
+    for (int i = 0; i < numAlns; ++i)
+        if (alns[i].p) free(alns[i].p);
+    free(alns);
+
+    return hits;
+}
+
 // Read/MappedRead API
 std::unique_ptr<std::vector<AlignedRead>> MM2Helper::Align(
     const std::unique_ptr<std::vector<Data::Read>>& records,
@@ -880,6 +1385,24 @@ std::vector<AlignedRead> MM2Helper::Align(const Data::Read& record,
     return Align(record, noopFilter, tbuf);
 }
 
+// FASTA/FASTQ API
+std::vector<AlignedRecord> MM2Helper::Align(const FastxRecord& record, const FilterFunc& filter,
+                                            std::unique_ptr<ThreadBuffer>& tbuf) const
+{
+    return AlignImpl(record, filter, tbuf);
+}
+
+BAM::BamRecord FastxRecord::ToBam() const
+{
+    BAM::BamRecord record(Header);
+    record.Impl().SetSequenceAndQualities(Bases, Qualities);
+    record.ReadGroupId(ReadGroupId);
+    record.Impl().Name(Name);
+    record.Impl().AddTag("qs", 0);
+    record.Impl().AddTag("qe", static_cast<int32_t>(Bases.size()));
+    return record;
+}
+
 // BamRecord API
 std::vector<AlignedRecord> MM2Helper::Align(const BAM::BamRecord& record, const FilterFunc& filter,
                                             std::unique_ptr<ThreadBuffer>& tbuf) const
@@ -978,48 +1501,12 @@ AlignedRecordImpl<T>::AlignedRecordImpl(T record) : Record(std::move(record))
 template <typename T>
 void AlignedRecordImpl<T>::ComputeAccuracyBases()
 {
-    int32_t ins = 0;
-    int32_t del = 0;
-    int32_t insEvents = 0;
-    int32_t delEvents = 0;
-    int32_t mismatch = 0;
-    int32_t match = 0;
-    for (const auto& cigar : Record.CigarData()) {
-        int32_t len = cigar.Length();
-        switch (cigar.Type()) {
-            case Data::CigarOperationType::INSERTION:
-                ins += len;
-                ++insEvents;
-                break;
-            case Data::CigarOperationType::DELETION:
-                del += len;
-                ++delEvents;
-                break;
-            case Data::CigarOperationType::SEQUENCE_MISMATCH:
-                mismatch += len;
-                break;
-            case Data::CigarOperationType::REFERENCE_SKIP:
-                break;
-            case Data::CigarOperationType::SEQUENCE_MATCH:
-            case Data::CigarOperationType::ALIGNMENT_MATCH:
-                match += len;
-                break;
-            case Data::CigarOperationType::PADDING:
-            case Data::CigarOperationType::SOFT_CLIP:
-            case Data::CigarOperationType::HARD_CLIP:
-                break;
-            case Data::CigarOperationType::UNKNOWN_OP:
-            default:
-                throw AbortException("UNKNOWN OP");
-                break;
-        }
-    }
+    const auto counts = CigarCounts::FromCigar(Record.CigarData());
     Span = Record.AlignedEnd() - Record.AlignedStart();
-    NumAlignedBases = match + ins + mismatch;
-    Concordance =
-        boost::algorithm::clamp(100 * (1.0 - 1.0 * (ins + del + mismatch) / Span), 0.0, 100.0);
-    Identity = 100.0 * match / (match + mismatch + del + ins);
-    IdentityGapComp = 100.0 * match / (match + mismatch + delEvents + insEvents);
+    NumAlignedBases = counts.NumAlignedBases();
+    Concordance = counts.Concordance(Span);
+    Identity = counts.Identity();
+    IdentityGapComp = counts.IdentityGapComp();
     const auto SetTag = [&](const char* tag, float value) {
         if (Record.Impl().HasTag(tag))
             Record.Impl().EditTag(tag, value);
@@ -0,0 +1,97 @@
+// Author: Armin Töpfer
+
+#include "MedianFilter.h"
+
+#include <algorithm>
+#include <sstream>
+#include <tuple>
+
+#include <pbbam/BamReader.h>
+#include <pbbam/DataSet.h>
+#include <pbbam/PbiRawData.h>
+
+#include <pbcopper/data/LocalContextFlags.h>
+#include <pbcopper/logging/Logging.h>
+
+#include "AbortException.h"
+
+namespace PacBio {
+namespace minimap2 {
+size_t MedianFilter::Pick(std::vector<MedianCandidate>& candidates)
+{
+    const bool hasFullLength = std::any_of(candidates.cbegin(), candidates.cend(),
+                                           [](const MedianCandidate& c) { return c.FullLength; });
+    if (hasFullLength) {
+        candidates.erase(std::remove_if(candidates.begin(), candidates.end(),
+                                        [](const MedianCandidate& c) { return !c.FullLength; }),
+                         candidates.end());
+    }
+
+    std::stable_sort(candidates.begin(), candidates.end(),
+                     [](const MedianCandidate& l, const MedianCandidate& r) {
+                         return std::tie(l.FullLength, l.Length) < std::tie(r.FullLength, r.Length);
+                     });
+    return candidates.size() / 2;
+}
+
+std::string MedianFilter::Describe(const std::vector<MedianCandidate>& candidates, const size_t mid)
+{
+    std::ostringstream ss;
+    for (size_t x = 0; x < candidates.size(); ++x) {
+        const auto& c = candidates[x];
+        if (x == mid) ss << '[';
+        ss << c.Length << (c.FullLength ? 'F' : 'S');
+        if (x == mid) ss << ']';
+        ss << ' ';
+    }
+    return ss.str();
+}
+
+void MedianFilter::FromPbi(const std::string& file, const BAM::PbiFilter& filter, const bool trace,
+                           const RecordFunc& callback)
+{
+    const BAM::DataSet ds(file);
+    for (const auto& bamFile : ds.BamFiles()) {
+        const BAM::PbiRawData index(bamFile.PacBioIndexFilename());
+        const auto& basic = index.BasicData();
+        const size_t numRows = basic.holeNumber_.size();
+
+        BAM::BamReader reader(bamFile.Filename());
+        std::vector<MedianCandidate> candidates;
+        std::vector<size_t> rows;
+        const auto Flush = [&]() {
+            if (rows.empty()) return true;
+            const size_t mid = Pick(candidates);
+            const size_t row = rows[candidates[mid].Index];
+            reader.VirtualSeek(basic.fileOffset_[row]);
+            BAM::BamRecord record;
+            if (!reader.GetNext(record))
+                throw AbortException("Could not read record at PBI row " + std::to_string(row) +
+                                     " of " + bamFile.Filename());
+            if (trace) {
+                PBLOG_TRACE << "Median filter " << record.MovieName() << '/' << record.HoleNumber()
+                            << ": " << Describe(candidates, mid);
+            }
+            candidates.clear();
+            rows.clear();
+            return callback(std::move(record));
+        };
+
+        for (size_t row = 0; row < numRows; ++row) {
+            if (!filter.IsEmpty() && !filter.Accepts(index, row)) continue;
+            if (!rows.empty() &&
+                (basic.holeNumber_[row] != basic.holeNumber_[rows.front()] ||
+                 basic.rgId_[row] != basic.rgId_[rows.front()]) &&
+                !Flush())
+                return;
+            const auto flags = basic.ctxtFlag_[row];
+            const bool fullLength = (flags & Data::ADAPTER_BEFORE) && (flags & Data::ADAPTER_AFTER);
+            candidates.emplace_back(
+                MedianCandidate{basic.qEnd_[row] - basic.qStart_[row], fullLength, rows.size()});
+            rows.emplace_back(row);
+        }
+        if (!Flush()) return;
+    }
+}
+}  // namespace minimap2
+}  // namespace PacBio
@@ -0,0 +1,44 @@
+// Author: Armin Töpfer
+
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include <pbbam/BamRecord.h>
+#include <pbbam/PbiFilter.h>
+
+namespace PacBio {
+namespace minimap2 {
+struct MedianCandidate
+{
+    int32_t Length;
+    bool FullLength;
+    // Position of the subread within its ZMW
+    size_t Index;
+};
+
+/// Selects the subread of median length per ZMW. If a ZMW has full-length
+/// subreads, with adapters before and after, only those are considered.
+class MedianFilter
+{
+public:
+    // Returns false to stop reading
+    using RecordFunc = std::function<bool(BAM::BamRecord&&)>;
+
+public:
+    /// Reorders candidates and returns the position of the median in it
+    static size_t Pick(std::vector<MedianCandidate>& candidates);
+
+    /// Lengths of the candidates, the median in brackets
+    static std::string Describe(const std::vector<MedianCandidate>& candidates, size_t mid);
+
+    /// Selects the median subreads of the PBI rows passing filter, from the
+    /// .pbi files of all BAM files in file, and decodes only those records.
+    static void FromPbi(const std::string& file, const BAM::PbiFilter& filter, bool trace,
+                        const RecordFunc& callback);
+};
+}  // namespace minimap2
+}  // namespace PacBio
@@ -0,0 +1,69 @@
+// Author: Armin Töpfer
+#include "MergeSettings.h"
+
+#include <pbmm2/Pbmm2Version.h>
+
+#include "AbortException.h"
+
+namespace PacBio {
+namespace minimap2 {
+namespace OptionNames {
+// clang-format off
+
+const CLI_v2::Option MergeBamIndex{
+R"({
+    "names" : ["bam-index"],
+    "description" : "Generate index for merged BAM output.",
+    "type" : "string",
+    "choices" : ["NONE", "BAI", "CSI"],
+    "default" : "BAI"
+})"};
+
+const CLI_v2::PositionalArgument MergeInput {
+R"({
+    "name" : "in.bam|xml|fofn",
+    "description" : "Sorted aligned BAM files, AlignmentSet XMLs, or a FOFN of them"
+})"};
+
+const CLI_v2::PositionalArgument MergeOutput {
+R"({
+    "name" : "out.bam|xml|json",
+    "description" : "Output BAM, AlignmentSet XML, or datastore JSON"
+})"};
+
+// clang-format on
+}  // namespace OptionNames
+
+MergeSettings::MergeSettings(const PacBio::CLI_v2::Results& options)
+    : CLI{options.InputCommandLine()}, InputFiles{options.PositionalArguments()}
+{
+    NumThreads = options.NumThreads();
+    const std::string bamIdx = options[OptionNames::MergeBamIndex];
+    BamIdx = BamIndex::_from_string(bamIdx.c_str());
+    if (InputFiles.size() < 2)
+        throw AbortException("Please provide at least one input and the output file!");
+}
+
+PacBio::CLI_v2::Interface MergeSettings::CreateCLI()
+{
+    PacBio::CLI_v2::Interface i{"pbmm2 merge", "Merge coordinate-sorted BAM files and index them",
+                                PacBio::Pbmm2FormattedVersion()};
+
+    i.Example(
+        "pbmm2 merge shard1.alignmentset.xml shard2.alignmentset.xml merged.alignmentset.xml");
+
+    // clang-format off
+    i.AddPositionalArguments({
+        OptionNames::MergeInput,
+        OptionNames::MergeOutput
+    });
+
+    i.AddOptionGroup("Output Options", {
+        OptionNames::MergeBamIndex,
+    });
+
+    // clang-format on
+    return i;
+}
+}  // namespace minimap2
+}  // namespace PacBio
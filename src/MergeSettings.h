@@ -0,0 +1,32 @@
+// Author: Armin Töpfer
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <pbcopper/cli2/CLI.h>
+
+#include "BamIndex.h"
+
+namespace PacBio {
+namespace minimap2 {
+/// Contains user provided CLI configuration
+struct MergeSettings
+{
+    const std::string CLI;
+    const std::vector<std::string> InputFiles;
+    std::string OutputFile;
+    BamIndex BamIdx = BamIndex::BAI;
+    int32_t NumThreads;
+
+    /// Parses the provided CLI::Results and retrieves a defined set of options.
+    MergeSettings(const PacBio::CLI_v2::Results& options);
+
+    /// Given the description of the tool and its version, create all
+    /// necessary CLI::Options for the merge subcommand.
+    static PacBio::CLI_v2::Interface CreateCLI();
+};
+}  // namespace minimap2
+}  // namespace PacBio
@@ -0,0 +1,221 @@
+// Author: Armin Töpfer
+
+#include "MergeWorkflow.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <boost/algorithm/string.hpp>
+
+#include <htslib/sam.h>
+#include <pbbam/BamFile.h>
+#include <pbbam/DataSet.h>
+#include <pbbam/PbiFile.h>
+#include <pbcopper/logging/Logging.h>
+#include <pbcopper/utility/FileUtils.h>
+
+#include "AbortException.h"
+#include "InputOutputUX.h"
+#include "MergeSettings.h"
+#include "PbiMerger.h"
+#include "Timer.h"
+#include "bam_sort.h"
+
+namespace PacBio {
+namespace minimap2 {
+namespace {
+struct MergeSummary
+{
+    PbiMerger* Pbi = nullptr;
+    size_t NumAlns = 0;
+    size_t Bases = 0;
+};
+
+void OnRecord(void* data, const int input, const bam1_t* b, const int64_t length)
+{
+    auto* s = static_cast<MergeSummary*>(data);
+    if (s->Pbi) s->Pbi->AddRecord(input, b, length);
+    if (b->core.flag & BAM_FUNMAP) return;
+    ++s->NumAlns;
+    const uint32_t* cigar = bam_get_cigar(b);
+    for (uint32_t i = 0; i < b->core.n_cigar; ++i) {
+        const int op = bam_cigar_op(cigar[i]);
+        if (op == BAM_CMATCH || op == BAM_CINS || op == BAM_CEQUAL || op == BAM_CDIFF)
+            s->Bases += bam_cigar_oplen(cigar[i]);
+    }
+}
+
+// BAM files of all inputs, a FOFN lists BAM files or datasets
+std::vector<std::string> ExpandInputs(const std::vector<std::string>& inputs)
+{
+    std::vector<std::string> files;
+    for (const auto& input : inputs) {
+        if (!Utility::FileExists(input))
+            throw AbortException("Input data file does not exist: " + input);
+        if (boost::iends_with(input, ".fofn")) {
+            std::ifstream fofn(input);
+            std::string line;
+            while (std::getline(fofn, line)) {
+                boost::trim(line);
+                if (!line.empty()) files.emplace_back(line);
+            }
+        } else {
+            files.emplace_back(input);
+        }
+    }
+
+    std::vector<std::string> bamFiles;
+    for (const auto& file : files) {
+        if (!Utility::FileExists(file))
+            throw AbortException("Input data file does not exist: " + file);
+        for (const auto& bam : BAM::DataSet(file).BamFiles())
+            bamFiles.emplace_back(bam.Filename());
+    }
+    return bamFiles;
+}
+
+// Reference FASTA named by an AlignmentSet, empty if there is none
+std::string ReferenceOf(const BAM::DataSet& ds)
+{
+    for (const auto& resource : ds.ExternalResources())
+        for (const auto& nested : resource.ExternalResources())
+            if (nested.MetaType() == "PacBio.ReferenceFile.ReferenceFastaFile")
+                return nested.ResourceId();
+    return {};
+}
+
+// Warns if the inputs are shards of --shard, but not all of them
+void CheckShards(const std::vector<std::string>& bamFiles)
+{
+    static const std::string prefix = "pbmm2-shard:";
+    std::map<int32_t, int32_t> seen;
+    int32_t numShards = 0;
+    for (const auto& file : bamFiles) {
+        for (const auto& comment : BAM::BamFile(file).Header().Comments()) {
+            if (!boost::starts_with(comment, prefix)) continue;
+            int32_t index = 0;
+            int32_t n = 0;
+            if (std::sscanf(comment.c_str() + prefix.size(), "%d/%d", &index, &n) != 2) continue;
+            if (numShards != 0 && n != numShards)
+                PBLOG_WARN << "Input " << file << " is shard " << index << "/" << n
+                           << ", other inputs are split into " << numShards << " shards";
+            numShards = std::max(numShards, n);
+            ++seen[index];
+        }
+    }
+    for (int32_t i = 1; i <= numShards; ++i) {
+        if (seen[i] == 0)
+            PBLOG_WARN << "Shard " << i << "/" << numShards << " is missing from the inputs";
+        else if (seen[i] > 1)
+            PBLOG_WARN << "Shard " << i << "/" << numShards << " is given " << seen[i] << " times";
+    }
+}
+}  // namespace
+
+int MergeWorkflow::Runner(const CLI_v2::Results& options)
+{
+    const Timer startTime;
+    MergeSettings settings(options);
+
+    const std::string outFile = settings.InputFiles.back();
+    const std::vector<std::string> inputs(settings.InputFiles.cbegin(),
+                                          settings.InputFiles.cend() - 1);
+    const std::string outPrefix = InputOutputUX::OutPrefix(outFile);
+    const std::string bamFile = outPrefix + ".bam";
+    const bool isToXML = boost::iends_with(outFile, ".xml");
+    const bool isToJson = boost::iends_with(outFile, ".json");
+
+    const auto bamFiles = ExpandInputs(inputs);
+    if (bamFiles.empty()) throw AbortException("No BAM files found in the inputs!");
+    for (const auto& file : bamFiles) {
+        if (file == bamFile) throw AbortException("Output file is also an input: " + bamFile);
+        if (BAM::BamFile(file).Header().SortOrder() != "coordinate")
+            throw AbortException("Input " + file + " is not sorted by coordinate");
+    }
+    CheckShards(bamFiles);
+    if (Utility::FileExists(bamFile))
+        PBLOG_WARN << "Warning: Overwriting existing output file: " << bamFile;
+
+    std::string indexFile;
+    int32_t minShift = -1;
+    switch (settings.BamIdx) {
+        case BamIndex::BAI:
+            indexFile = bamFile + ".bai";
+            minShift = 0;
+            break;
+        case BamIndex::CSI:
+            indexFile = bamFile + ".csi";
+            minShift = 14;
+            break;
+        default:
+            break;
+    }
+
+    // the .pbi is assembled from the input indices, if all of them exist in
+    // the version that pbbam writes
+    const auto pbiMerger = PbiMerger::Create(bamFiles);
+    const std::string gziFile = bamFile + ".gzi";
+    MergeSummary summary;
+    summary.Pbi = pbiMerger.get();
+
+    bam_merge_output_t output;
+    output.index_min_shift = minShift;
+    output.index_name = indexFile.empty() ? nullptr : indexFile.c_str();
+    output.gzi_name = pbiMerger ? gziFile.c_str() : nullptr;
+    output.first_block = 0;
+    output.on_record = &OnRecord;
+    output.on_record_data = &summary;
+
+    PBLOG_INFO << "Merging " << bamFiles.size() << " BAM files using " << settings.NumThreads
+               << " threads";
+    Timer mergeTime;
+    std::vector<char*> names;
+    for (const auto& file : bamFiles)
+        names.emplace_back(const_cast<char*>(file.c_str()));
+    if (bam_merge(bamFile.c_str(), static_cast<int>(names.size()), names.data(),
+                  settings.NumThreads, &output) != 0)
+        throw AbortException("Could not merge into " + bamFile);
+    mergeTime.Freeze();
+
+    Timer pbiTime;
+    if (pbiMerger) {
+        const auto numReferences =
+            static_cast<int32_t>(BAM::BamFile(bamFile).Header().Sequences().size());
+        pbiMerger->Write(bamFile + ".pbi", gziFile, output.first_block, numReferences,
+                         settings.NumThreads);
+        std::remove(gziFile.c_str());
+    } else {
+        PBLOG_INFO << "Input .pbi files cannot be merged, indexing " << bamFile;
+        BAM::PbiFile::CreateFrom(BAM::BamFile(bamFile));
+    }
+    pbiTime.Freeze();
+
+    if (isToXML || isToJson) {
+        const bool isFromXML = boost::iends_with(inputs.front(), ".xml");
+        const BAM::DataSet dsIn =
+            isFromXML ? BAM::DataSet(inputs.front())
+                      : BAM::DataSet(InputOutputUX::DataSetType(BAM::BamFile(bamFile).Header()));
+        std::string id;
+        const auto xmlName =
+            InputOutputUX::CreateDataSet(dsIn, ReferenceOf(dsIn), false, outPrefix, outFile, &id,
+                                         summary.NumAlns, summary.Bases, settings.BamIdx);
+        if (isToJson)
+            InputOutputUX::WriteDatastore(outPrefix + ".json", dsIn.Type(),
+                                          "mapping.tasks.pbmm2_merge-out-1", {bamFile}, {xmlName},
+                                          {id});
+    }
+
+    PBLOG_INFO << "Alignments: " << summary.NumAlns;
+    PBLOG_INFO << "Mapped Bases: " << summary.Bases;
+    PBLOG_INFO << "Merge Time: " << mergeTime.ElapsedTime();
+    PBLOG_INFO << "PBI Generation Time: " << pbiTime.ElapsedTime();
+    PBLOG_INFO << "Run Time: " << startTime.ElapsedTime();
+    return EXIT_SUCCESS;
+}
+}  // namespace minimap2
+}  // namespace PacBio
@@ -0,0 +1,92 @@
+// Author: Armin Töpfer
+
+#include "OrderedParallelReader.h"
+
+#include <algorithm>
+
+namespace PacBio {
+namespace minimap2 {
+namespace {
+// Unwinds a task once the consumer is gone
+struct ReaderStopped
+{};
+}  // namespace
+
+OrderedParallelReader::OrderedParallelReader(std::vector<Task> tasks, const int32_t numThreads,
+                                             const size_t maxQueued)
+    : tasks_(std::move(tasks)), slots_(tasks_.size()), maxQueued_(std::max<size_t>(1, maxQueued))
+{
+    const int32_t n = std::min<int32_t>(std::max(1, numThreads), tasks_.size());
+    for (int32_t i = 0; i < n; ++i)
+        threads_.emplace_back([this]() { Work(); });
+}
+
+OrderedParallelReader::~OrderedParallelReader()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    consumed_.notify_all();
+    for (auto& t : threads_)
+        t.join();
+}
+
+bool OrderedParallelReader::GetNext(BAM::BamRecord& record)
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+        if (error_) std::rethrow_exception(error_);
+        if (current_ == slots_.size()) return false;
+        auto& slot = slots_[current_];
+        if (!slot.Records.empty()) {
+            const bool wasFull = slot.Records.size() >= maxQueued_;
+            record = std::move(slot.Records.front());
+            slot.Records.pop_front();
+            if (wasFull) consumed_.notify_all();
+            return true;
+        }
+        if (slot.Done) {
+            ++current_;
+            continue;
+        }
+        produced_.wait(lock);
+    }
+}
+
+void OrderedParallelReader::Push(const size_t idx, BAM::BamRecord&& record)
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    auto& slot = slots_[idx];
+    consumed_.wait(lock, [&]() { return stop_ || slot.Records.size() < maxQueued_; });
+    if (stop_) throw ReaderStopped{};
+    slot.Records.emplace_back(std::move(record));
+    if (idx == current_ && slot.Records.size() == 1) produced_.notify_one();
+}
+
+void OrderedParallelReader::Work()
+{
+    while (true) {
+        size_t idx;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (stop_ || error_ || nextTask_ == tasks_.size()) return;
+            idx = nextTask_++;
+        }
+        try {
+            tasks_[idx]([&](BAM::BamRecord&& record) { Push(idx, std::move(record)); });
+        } catch (const ReaderStopped&) {
+            return;
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (!error_) error_ = std::current_exception();
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            slots_[idx].Done = true;
+        }
+        produced_.notify_one();
+    }
+}
+}  // namespace minimap2
+}  // namespace PacBio
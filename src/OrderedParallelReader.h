@@ -0,0 +1,63 @@
+// Author: Armin Töpfer
+
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <pbbam/BamRecord.h>
+
+namespace PacBio {
+namespace minimap2 {
+/// Runs reader tasks on multiple threads and hands out their records in task
+/// order. Every task has its own bounded queue and at most one task per thread
+/// is read ahead, which bounds memory while the consumer is busy.
+class OrderedParallelReader
+{
+public:
+    using EmitFunc = std::function<void(BAM::BamRecord&&)>;
+    using Task = std::function<void(const EmitFunc&)>;
+
+public:
+    OrderedParallelReader(std::vector<Task> tasks, int32_t numThreads, size_t maxQueued = 64);
+    ~OrderedParallelReader();
+
+    OrderedParallelReader(const OrderedParallelReader&) = delete;
+    OrderedParallelReader& operator=(const OrderedParallelReader&) = delete;
+
+    /// Rethrows the first error of any task
+    bool GetNext(BAM::BamRecord& record);
+
+private:
+    struct Slot
+    {
+        std::deque<BAM::BamRecord> Records;
+        bool Done = false;
+    };
+
+    void Work();
+    void Push(size_t idx, BAM::BamRecord&& record);
+
+private:
+    std::vector<Task> tasks_;
+    std::vector<Slot> slots_;
+    const size_t maxQueued_;
+
+    std::mutex mutex_;
+    std::condition_variable produced_;
+    std::condition_variable consumed_;
+    size_t nextTask_ = 0;
+    size_t current_ = 0;
+    bool stop_ = false;
+    std::exception_ptr error_;
+
+    std::vector<std::thread> threads_;
+};
+}  // namespace minimap2
+}  // namespace PacBio
@@ -0,0 +1,233 @@
+// Author: Armin Töpfer
+
+#include "PbiMerger.h"
+
+#include <algorithm>
+#include <fstream>
+#include <limits>
+
+#include <htslib/bgzf.h>
+#include <pbbam/BamFile.h>
+#include <pbbam/PbiFile.h>
+
+#include "AbortException.h"
+
+namespace PacBio {
+namespace minimap2 {
+namespace {
+// Version whose layout is written below, any other one is left to pbbam
+constexpr auto MergedVersion = BAM::PbiFile::Version_3_0_1;
+constexpr uint32_t UnsetRow = std::numeric_limits<uint32_t>::max();
+
+using BgzfPtr = std::unique_ptr<BGZF, int (*)(BGZF*)>;
+
+class PbiWriter
+{
+public:
+    PbiWriter(const std::string& file, const int32_t numThreads)
+        : file_(file), fp_(bgzf_open(file.c_str(), "wb"), bgzf_close)
+    {
+        if (!fp_) throw AbortException("Could not create " + file);
+        if (numThreads > 1) bgzf_mt(fp_.get(), numThreads, 256);
+    }
+
+    template <typename T>
+    void Write(const T& value)
+    {
+        if (bgzf_write(fp_.get(), &value, sizeof(T)) != sizeof(T))
+            throw AbortException("Could not write " + file_);
+    }
+
+    // Column of n rows, each converted to the on-disk type
+    template <typename Disk, typename Func>
+    void WriteColumn(const size_t n, Func valueOf)
+    {
+        std::vector<Disk> column(n);
+        for (size_t i = 0; i < n; ++i)
+            column[i] = static_cast<Disk>(valueOf(i));
+        const auto bytes = static_cast<ssize_t>(n * sizeof(Disk));
+        if (n > 0 && bgzf_write(fp_.get(), column.data(), bytes) != bytes)
+            throw AbortException("Could not write " + file_);
+    }
+
+    void Close()
+    {
+        if (bgzf_close(fp_.release()) != 0) throw AbortException("Could not write " + file_);
+    }
+
+private:
+    const std::string file_;
+    BgzfPtr fp_;
+};
+
+// Pairs of compressed and uncompressed offsets of each BGZF block after the first
+void ReadGzi(const std::string& file, std::vector<uint64_t>* compressed,
+             std::vector<uint64_t>* uncompressed)
+{
+    std::ifstream in(file, std::ios::binary);
+    uint64_t n = 0;
+    if (!in.read(reinterpret_cast<char*>(&n), sizeof(n)))
+        throw AbortException("Could not read block offsets of " + file);
+    compressed->assign(1, 0);
+    uncompressed->assign(1, 0);
+    for (uint64_t i = 0; i < n; ++i) {
+        uint64_t c, u;
+        if (!in.read(reinterpret_cast<char*>(&c), sizeof(c)) ||
+            !in.read(reinterpret_cast<char*>(&u), sizeof(u)))
+            throw AbortException("Could not read block offsets of " + file);
+        compressed->emplace_back(c);
+        uncompressed->emplace_back(u);
+    }
+}
+}  // namespace
+
+PbiMerger::PbiMerger(std::vector<std::string> pbiFiles,
+                     std::vector<std::unique_ptr<BAM::PbiRawData>> indices)
+    : pbiFiles_(std::move(pbiFiles)), indices_(std::move(indices))
+{}
+
+std::unique_ptr<PbiMerger> PbiMerger::Create(const std::vector<std::string>& bamFiles)
+{
+    if (BAM::PbiFile::CurrentVersion != MergedVersion) return nullptr;
+    std::vector<std::string> pbiFiles;
+    for (const auto& bamFile : bamFiles) {
+        const BAM::BamFile bam(bamFile);
+        if (!bam.PacBioIndexExists()) return nullptr;
+        pbiFiles.emplace_back(bam.PacBioIndexFilename());
+    }
+    std::vector<std::unique_ptr<BAM::PbiRawData>> indices;
+    for (const auto& file : pbiFiles) {
+        indices.emplace_back(std::make_unique<BAM::PbiRawData>(file));
+        if (indices.back()->Version() != MergedVersion) return nullptr;
+    }
+    return std::unique_ptr<PbiMerger>(new PbiMerger(std::move(pbiFiles), std::move(indices)));
+}
+
+void PbiMerger::AddRecord(const int32_t input, const bam1_t* record, const int64_t length)
+{
+    inputs_.emplace_back(input);
+    tIds_.emplace_back(record->core.tid);
+    offsets_.emplace_back(nextOffset_);
+    nextOffset_ += length;
+}
+
+void PbiMerger::Write(const std::string& pbiFile, const std::string& gziFile,
+                      const int64_t firstBlock, const int32_t numReferences,
+                      const int32_t numThreads) const
+{
+    std::vector<uint64_t> blockStart;
+    std::vector<uint64_t> blockUncompressed;
+    ReadGzi(gziFile, &blockStart, &blockUncompressed);
+    const auto first = std::find(blockStart.cbegin(), blockStart.cend(), firstBlock);
+    if (first == blockStart.cend())
+        throw AbortException("Could not find the first record block in " + gziFile);
+    const uint64_t firstRecord = blockUncompressed[first - blockStart.cbegin()];
+
+    // sections present in any input, barcodes only if all inputs have them
+    BAM::PbiFile::Sections sections = BAM::PbiFile::BASIC | BAM::PbiFile::REFERENCE;
+    bool barcodes = true;
+    for (const auto& index : indices_) {
+        sections |= index->FileSections() & BAM::PbiFile::MAPPED;
+        barcodes &= index->HasBarcodeData();
+    }
+    if (barcodes) sections |= BAM::PbiFile::BARCODE;
+    const bool mapped = sections & BAM::PbiFile::MAPPED;
+
+    // input row of every output record
+    const size_t numReads = inputs_.size();
+    std::vector<uint32_t> rows(numReads);
+    std::vector<uint32_t> nextRow(indices_.size(), 0);
+    for (size_t i = 0; i < numReads; ++i)
+        rows[i] = nextRow[inputs_[i]]++;
+    for (size_t i = 0; i < indices_.size(); ++i)
+        if (nextRow[i] != indices_[i]->NumReads())
+            throw AbortException("Index " + pbiFiles_[i] + " does not match its BAM file.");
+
+    const auto Basic = [&](const size_t i) -> const BAM::PbiRawBasicData& {
+        return indices_[inputs_[i]]->BasicData();
+    };
+    const auto Mapped = [&](const size_t i) -> const BAM::PbiRawMappedData* {
+        const auto& index = *indices_[inputs_[i]];
+        return index.HasMappedData() ? &index.MappedData() : nullptr;
+    };
+    const auto Barcode = [&](const size_t i) -> const BAM::PbiRawBarcodeData& {
+        return indices_[inputs_[i]]->BarcodeData();
+    };
+    const auto FileOffset = [&](const size_t i) {
+        const uint64_t u = firstRecord + offsets_[i];
+        const size_t block =
+            std::upper_bound(blockUncompressed.cbegin(), blockUncompressed.cend(), u) -
+            blockUncompressed.cbegin() - 1;
+        return static_cast<int64_t>((blockStart[block] << 16) | (u - blockUncompressed[block]));
+    };
+
+    PbiWriter out(pbiFile, numThreads);
+    for (const char c : {'P', 'B', 'I', '\1'})
+        out.Write(c);
+    out.Write(static_cast<uint32_t>(MergedVersion));
+    out.Write(static_cast<uint16_t>(sections));
+    out.Write(static_cast<uint32_t>(numReads));
+    for (int i = 0; i < 18; ++i)
+        out.Write('\0');
+    if (numReads == 0) {
+        out.Close();
+        return;
+    }
+
+    out.WriteColumn<int32_t>(numReads, [&](size_t i) { return Basic(i).rgId_[rows[i]]; });
+    out.WriteColumn<int32_t>(numReads, [&](size_t i) { return Basic(i).qStart_[rows[i]]; });
+    out.WriteColumn<int32_t>(numReads, [&](size_t i) { return Basic(i).qEnd_[rows[i]]; });
+    out.WriteColumn<int32_t>(numReads, [&](size_t i) { return Basic(i).holeNumber_[rows[i]]; });
+    out.WriteColumn<float>(numReads, [&](size_t i) { return Basic(i).readQual_[rows[i]]; });
+    out.WriteColumn<uint8_t>(numReads, [&](size_t i) { return Basic(i).ctxtFlag_[rows[i]]; });
+    out.WriteColumn<int64_t>(numReads, FileOffset);
+
+    if (mapped) {
+        // inputs without mapped records have no mapped section
+        const auto MappedOr = [&](const size_t i, const uint32_t unmapped, const auto member) {
+            const auto* m = Mapped(i);
+            return m ? static_cast<uint32_t>((m->*member)[rows[i]]) : unmapped;
+        };
+        using M = BAM::PbiRawMappedData;
+        out.WriteColumn<int32_t>(numReads, [&](size_t i) { return tIds_[i]; });
+        out.WriteColumn<uint32_t>(numReads,
+                                  [&](size_t i) { return MappedOr(i, UnsetRow, &M::tStart_); });
+        out.WriteColumn<uint32_t>(numReads,
+                                  [&](size_t i) { return MappedOr(i, UnsetRow, &M::tEnd_); });
+        out.WriteColumn<uint32_t>(numReads,
+                                  [&](size_t i) { return MappedOr(i, UnsetRow, &M::aStart_); });
+        out.WriteColumn<uint32_t>(numReads,
+                                  [&](size_t i) { return MappedOr(i, UnsetRow, &M::aEnd_); });
+        out.WriteColumn<uint8_t>(numReads,
+                                 [&](size_t i) { return MappedOr(i, 0, &M::revStrand_); });
+        out.WriteColumn<uint32_t>(numReads, [&](size_t i) { return MappedOr(i, 0, &M::nM_); });
+        out.WriteColumn<uint32_t>(numReads, [&](size_t i) { return MappedOr(i, 0, &M::nMM_); });
+        out.WriteColumn<uint8_t>(numReads, [&](size_t i) { return MappedOr(i, 255, &M::mapQV_); });
+    }
+
+    // rows of each reference, unmapped records last
+    std::vector<std::pair<uint32_t, uint32_t>> refRows(numReferences + 1, {UnsetRow, UnsetRow});
+    for (size_t i = 0; i < numReads; ++i) {
+        const int32_t tId = tIds_[i];
+        auto& range = refRows[tId >= 0 && tId < numReferences ? tId : numReferences];
+        if (range.first == UnsetRow) range.first = i;
+        range.second = i + 1;
+    }
+    out.Write(static_cast<uint32_t>(refRows.size()));
+    for (size_t tId = 0; tId < refRows.size(); ++tId) {
+        out.Write(tId < static_cast<size_t>(numReferences) ? static_cast<int32_t>(tId) : -1);
+        out.Write(refRows[tId].first);
+        out.Write(refRows[tId].second);
+    }
+
+    if (barcodes) {
+        out.WriteColumn<int16_t>(numReads,
+                                 [&](size_t i) { return Barcode(i).bcForward_[rows[i]]; });
+        out.WriteColumn<int16_t>(numReads,
+                                 [&](size_t i) { return Barcode(i).bcReverse_[rows[i]]; });
+        out.WriteColumn<int8_t>(numReads, [&](size_t i) { return Barcode(i).bcQual_[rows[i]]; });
+    }
+    out.Close();
+}
+}  // namespace minimap2
+}  // namespace PacBio
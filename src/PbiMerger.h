@@ -0,0 +1,54 @@
+// Author: Armin Töpfer
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <htslib/sam.h>
+#include <pbbam/PbiRawData.h>
+
+namespace PacBio {
+namespace minimap2 {
+/// Builds the .pbi file of a merged BAM file from the .pbi files of its inputs,
+/// without reading the merged records again.
+///
+/// The merge reads every input front to back, thus the n-th record taken from
+/// an input is row n of its index. Read groups with the same ID are combined,
+/// so only reference and file offset of a row can change. File offsets of a
+/// multi-threaded BGZF writer are not known while writing; they are derived
+/// from the position of each record in the uncompressed stream and the block
+/// offsets of a .gzi file.
+class PbiMerger
+{
+public:
+    /// Returns nullptr if an input has no .pbi file, or if the .pbi files are
+    /// not of the version that pbbam writes and whose layout is merged here
+    static std::unique_ptr<PbiMerger> Create(const std::vector<std::string>& bamFiles);
+
+    /// Records are added in output order, length is their uncompressed size
+    void AddRecord(int32_t input, const bam1_t* record, int64_t length);
+
+    /// firstBlock is the file offset of the block holding the first record
+    void Write(const std::string& pbiFile, const std::string& gziFile, int64_t firstBlock,
+               int32_t numReferences, int32_t numThreads) const;
+
+private:
+    PbiMerger(std::vector<std::string> pbiFiles,
+              std::vector<std::unique_ptr<BAM::PbiRawData>> indices);
+
+private:
+    const std::vector<std::string> pbiFiles_;
+    const std::vector<std::unique_ptr<BAM::PbiRawData>> indices_;
+
+    // one entry per output record
+    std::vector<int32_t> inputs_;
+    std::vector<int32_t> tIds_;
+    // relative to the first record
+    std::vector<int64_t> offsets_;
+    int64_t nextOffset_ = 0;
+};
+}  // namespace minimap2
+}  // namespace PacBio
@@ -0,0 +1,209 @@
+// Author: Armin Töpfer
+
+#include "PerfCounters.h"
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include <atomic>
+#include <cstring>
+#include <iomanip>
+#include <mutex>
+#include <sstream>
+#include <utility>
+
+namespace PacBio {
+namespace minimap2 {
+namespace {
+constexpr int NumStages = static_cast<int>(PerfStage::NUM_STAGES);
+
+std::atomic_bool perfEnabled{false};
+
+std::mutex registryMutex;
+std::vector<std::pair<PerfStage, std::shared_ptr<const PerfCounterGroup>>> registry;
+
+const char* StageName(const int stage)
+{
+    switch (static_cast<PerfStage>(stage)) {
+        case PerfStage::MAP:
+            return "mm_map";
+        case PerfStage::RECORD:
+            return "Record Construction";
+        case PerfStage::WRITE:
+            return "BAM Writing";
+        case PerfStage::SORT:
+            return "Sorting";
+        default:
+            return "Unknown";
+    }
+}
+
+#ifdef __linux__
+int OpenCounter(const uint64_t config, const bool inherit, const int groupFd)
+{
+    perf_event_attr attr;
+    std::memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = config;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.inherit = inherit ? 1 : 0;
+    // members follow the state of the leader
+    attr.disabled = groupFd < 0 ? 1 : 0;
+    attr.read_format =
+        PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    // pid 0 and cpu -1 counts the calling thread on any cpu
+    return static_cast<int>(syscall(__NR_perf_event_open, &attr, 0, -1, groupFd, 0));
+}
+#endif
+
+// Lazily opened per thread and stage; registered, such that the counts of
+// exited threads are still reported
+const PerfCounterGroup* ThreadGroup(const PerfStage stage)
+{
+    thread_local std::array<std::shared_ptr<PerfCounterGroup>, NumStages> groups;
+    auto& group = groups[static_cast<int>(stage)];
+    if (!group) {
+        group = std::make_shared<PerfCounterGroup>();
+        PerfCounters::Register(stage, group);
+    }
+    return group.get();
+}
+}  // namespace
+
+PerfCounterGroup::PerfCounterGroup(const bool inherit)
+{
+    fds_.fill(-1);
+#ifdef __linux__
+    fds_[0] = OpenCounter(PERF_COUNT_HW_CPU_CYCLES, inherit, -1);
+    if (fds_[0] < 0) return;
+    fds_[1] = OpenCounter(PERF_COUNT_HW_INSTRUCTIONS, inherit, fds_[0]);
+    fds_[2] = OpenCounter(PERF_COUNT_HW_CACHE_MISSES, inherit, fds_[0]);
+    fds_[3] = OpenCounter(PERF_COUNT_HW_BRANCH_MISSES, inherit, fds_[0]);
+#else
+    (void)inherit;
+#endif
+}
+
+PerfCounterGroup::~PerfCounterGroup()
+{
+#ifdef __linux__
+    for (const int fd : fds_)
+        if (fd >= 0) close(fd);
+#endif
+}
+
+bool PerfCounterGroup::IsOpen() const
+{
+    for (const int fd : fds_)
+        if (fd < 0) return false;
+    return true;
+}
+
+void PerfCounterGroup::Enable() const
+{
+#ifdef __linux__
+    ioctl(fds_[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+#endif
+}
+
+void PerfCounterGroup::Disable() const
+{
+#ifdef __linux__
+    ioctl(fds_[0], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+#endif
+}
+
+PerfCounterValues PerfCounterGroup::Read() const
+{
+    PerfCounterValues values;
+#ifdef __linux__
+    if (!IsOpen()) return values;
+    // number of counters, enabled and running time, then one value per counter
+    // in the order they were opened
+    std::array<uint64_t, 3 + 4> buffer;
+    const auto bytes = static_cast<ssize_t>(sizeof(buffer));
+    if (read(fds_[0], buffer.data(), bytes) != bytes || buffer[0] != 4) return values;
+    const uint64_t enabled = buffer[1];
+    const uint64_t running = buffer[2];
+    if (running == 0) return values;
+    const auto Scaled = [&](const uint64_t value) {
+        if (running >= enabled) return value;
+        return static_cast<uint64_t>(static_cast<double>(value) * enabled / running);
+    };
+    values.Cycles = Scaled(buffer[3]);
+    values.Instructions = Scaled(buffer[4]);
+    values.CacheMisses = Scaled(buffer[5]);
+    values.BranchMisses = Scaled(buffer[6]);
+#endif
+    return values;
+}
+
+bool PerfCounters::Enable()
+{
+    const PerfCounterGroup probe;
+    perfEnabled = probe.IsOpen();
+    return perfEnabled;
+}
+
+bool PerfCounters::IsEnabled() { return perfEnabled; }
+
+void PerfCounters::Register(const PerfStage stage, std::shared_ptr<const PerfCounterGroup> group)
+{
+    std::lock_guard<std::mutex> lock(registryMutex);
+    registry.emplace_back(stage, std::move(group));
+}
+
+std::vector<std::string> PerfCounters::Report()
+{
+    std::array<PerfCounterValues, NumStages> stages;
+    std::array<bool, NumStages> sampled{};
+    {
+        std::lock_guard<std::mutex> lock(registryMutex);
+        for (const auto& stage_group : registry) {
+            const int i = static_cast<int>(stage_group.first);
+            const auto values = stage_group.second->Read();
+            stages[i].Instructions += values.Instructions;
+            stages[i].Cycles += values.Cycles;
+            stages[i].CacheMisses += values.CacheMisses;
+            stages[i].BranchMisses += values.BranchMisses;
+            sampled[i] = sampled[i] || stage_group.second->IsOpen();
+        }
+    }
+
+    std::vector<std::string> lines;
+    for (int i = 0; i < NumStages; ++i) {
+        if (!sampled[i]) continue;
+        const auto& c = stages[i];
+        const double ipc = c.Cycles > 0 ? 1.0 * c.Instructions / c.Cycles : 0;
+        std::ostringstream os;
+        os << StageName(i) << ": instructions " << c.Instructions << ", cycles " << c.Cycles
+           << ", cache misses " << c.CacheMisses << ", branch misses " << c.BranchMisses << ", IPC "
+           << std::fixed << std::setprecision(2) << ipc;
+        lines.emplace_back(os.str());
+    }
+    return lines;
+}
+
+PerfScope::PerfScope(const PerfStage stage, const PerfCounterGroup* group)
+{
+    if (!PerfCounters::IsEnabled()) return;
+    group_ = group ? group : ThreadGroup(stage);
+    if (!group_->IsOpen()) {
+        group_ = nullptr;
+        return;
+    }
+    group_->Enable();
+}
+
+PerfScope::~PerfScope()
+{
+    if (group_) group_->Disable();
+}
+}  // namespace minimap2
+}  // namespace PacBio
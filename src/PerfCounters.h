@@ -0,0 +1,88 @@
+// Author: Armin Töpfer
+
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace PacBio {
+namespace minimap2 {
+enum class PerfStage : int
+{
+    MAP = 0,
+    RECORD,
+    WRITE,
+    SORT,
+    NUM_STAGES
+};
+
+struct PerfCounterValues
+{
+    uint64_t Instructions = 0;
+    uint64_t Cycles = 0;
+    uint64_t CacheMisses = 0;
+    uint64_t BranchMisses = 0;
+};
+
+/// Hardware counters of the calling thread via perf_event_open (Linux only),
+/// opened as one group that is scheduled onto the PMU as a unit and starts
+/// disabled. With inherit, threads spawned while the group is enabled are
+/// counted as well.
+class PerfCounterGroup
+{
+public:
+    explicit PerfCounterGroup(bool inherit = false);
+    ~PerfCounterGroup();
+
+    PerfCounterGroup(const PerfCounterGroup&) = delete;
+    PerfCounterGroup& operator=(const PerfCounterGroup&) = delete;
+
+    bool IsOpen() const;
+
+    /// Start and stop counting, one ioctl for all counters
+    void Enable() const;
+    void Disable() const;
+
+    /// Counts of all enabled periods, read at once and scaled by enabled over
+    /// running time if the PMU was multiplexed
+    PerfCounterValues Read() const;
+
+private:
+    // the cycles counter leads the group
+    std::array<int, 4> fds_;
+};
+
+class PerfCounters
+{
+public:
+    // Returns false if counters are not available on this host
+    static bool Enable();
+    static bool IsEnabled();
+
+    /// Group whose counts are attributed to stage in the report
+    static void Register(PerfStage stage, std::shared_ptr<const PerfCounterGroup> group);
+
+    // One line per stage that has been sampled; reads every registered group
+    static std::vector<std::string> Report();
+};
+
+/// Counts its lifetime towards a stage by enabling a group, counts are only
+/// read for the report. Without an explicit group, the calling thread's group
+/// of the stage is used.
+class PerfScope
+{
+public:
+    explicit PerfScope(PerfStage stage, const PerfCounterGroup* group = nullptr);
+    ~PerfScope();
+
+    PerfScope(const PerfScope&) = delete;
+    PerfScope& operator=(const PerfScope&) = delete;
+
+private:
+    const PerfCounterGroup* group_ = nullptr;
+};
+}  // namespace minimap2
+}  // namespace PacBio
@@ -0,0 +1,76 @@
+// Author: Armin Töpfer
+
+#include "RecordPool.h"
+
+#include <algorithm>
+
+namespace PacBio {
+namespace minimap2 {
+constexpr int64_t RecordPool::MaxRetainedBases;
+
+RecordPool::RecordPool(const int32_t chunkCapacity, const int32_t maxChunks)
+    : chunkCapacity_(std::max(1, chunkCapacity)), maxChunks_(std::max(1, maxChunks))
+{}
+
+RecordPool::Chunk RecordPool::TakeChunk()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!empty_.empty()) {
+            auto chunk = std::move(empty_.back());
+            empty_.pop_back();
+            // may have come from spare_, see TakeRecord
+            chunk->reserve(chunkCapacity_);
+            return chunk;
+        }
+    }
+    auto chunk = std::make_unique<std::vector<BAM::BamRecord>>();
+    chunk->reserve(chunkCapacity_);
+    return chunk;
+}
+
+BAM::BamRecord RecordPool::TakeRecord()
+{
+    if (spare_.empty()) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!released_.empty()) {
+            // the emptied buffer takes over the capacity of spare_
+            spare_.swap(*released_.back());
+            released_.back()->clear();
+            empty_.emplace_back(std::move(released_.back()));
+            released_.pop_back();
+        }
+    }
+    if (spare_.empty()) return BAM::BamRecord();
+    auto record = std::move(spare_.back());
+    spare_.pop_back();
+    retainedBases_ -= record.Impl().SequenceLength();
+    return record;
+}
+
+void RecordPool::Release(Chunk chunk)
+{
+    if (!chunk) return;
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (released_.size() + empty_.size() >= maxChunks_) return;
+
+    // keep records up to the base limit, the rest frees its storage
+    auto kept = chunk->begin();
+    for (auto it = chunk->begin(); it != chunk->end(); ++it) {
+        const int64_t length = it->Impl().SequenceLength();
+        if (retainedBases_ + length > MaxRetainedBases) continue;
+        retainedBases_ += length;
+        if (kept != it) *kept = std::move(*it);
+        ++kept;
+    }
+    chunk->erase(kept, chunk->end());
+    // a buffer that outgrew the chunk capacity is not kept at that size
+    if (chunk->capacity() > 2 * chunkCapacity_) chunk->shrink_to_fit();
+
+    if (chunk->empty())
+        empty_.emplace_back(std::move(chunk));
+    else
+        released_.emplace_back(std::move(chunk));
+}
+}  // namespace minimap2
+}  // namespace PacBio
@@ -0,0 +1,57 @@
+// Author: Armin Töpfer
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <pbbam/BamRecord.h>
+
+namespace PacBio {
+namespace minimap2 {
+/// Recycles chunk buffers and input records between the reader and the
+/// schedulers. Emitted chunks are handed back with Release. Their records keep
+/// the bam1_t storage of the previous read and are reused by TakeRecord, so
+/// that steady-state reading neither allocates vectors nor record data.
+/// At most maxChunks buffers and records of MaxRetainedBases are retained,
+/// such that memory stays bounded by the chunks in flight; surplus records,
+/// e.g. long reads, are freed on release.
+class RecordPool
+{
+public:
+    using Chunk = std::unique_ptr<std::vector<BAM::BamRecord>>;
+
+    static constexpr int64_t MaxRetainedBases = 1 << 22;
+
+public:
+    RecordPool(int32_t chunkCapacity, int32_t maxChunks);
+
+    /// Empty buffer with room for chunkCapacity records, reader thread only
+    Chunk TakeChunk();
+
+    /// Spare record to read into, reader thread only
+    BAM::BamRecord TakeRecord();
+
+    /// Thread-safe
+    void Release(Chunk chunk);
+
+private:
+    const size_t chunkCapacity_;
+    const size_t maxChunks_;
+
+    // drained by TakeRecord without locking
+    std::vector<BAM::BamRecord> spare_;
+    // of all records in spare_ and released_
+    std::atomic<int64_t> retainedBases_{0};
+
+    std::mutex mutex_;
+    // emitted chunks whose records have not been reused yet
+    std::vector<Chunk> released_;
+    // emptied buffers, capacity retained
+    std::vector<Chunk> empty_;
+};
+}  // namespace minimap2
+}  // namespace PacBio
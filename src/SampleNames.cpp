@@ -2,6 +2,7 @@
 #include "SampleNames.h"
 
 #include <fstream>
+#include <string>
 
 #include <pbbam/BamHeader.h>
 #include <pbbam/DataSet.h>
@@ -13,7 +14,9 @@
 
 #include "AbortException.h"
 #include "AlignSettings.h"
+#include "InputCatalog.h"
 #include "InputOutputUX.h"
+#include "StreamInput.h"
 
 namespace PacBio {
 namespace minimap2 {
@@ -51,17 +54,11 @@ MovieToSampleToInfix SampleNames::DetermineMovieToSampleToInfix(const UserIO& ui
 {
     MovieToSampleToInfix movieNameToSampleAndInfix;
     const auto FillForFile = [&](const std::string& f) {
-        BAM::DataSet ds;
-        try {
-            ds = BAM::DataSet{f};
-        } catch (...) {
-            throw AbortException(UNKNOWN_FILE_TYPES);
-        }
+        const auto& ds = uio.catalog->DataSet(f);
 
         // Check dataset's BAM header(s) for '@RG SM' tags.
         int namedSampleCount = 0;
-        for (const auto& bamFile : ds.BamFiles()) {
-            const auto& header = bamFile.Header();
+        for (const auto& header : uio.catalog->Headers(f)) {
             for (const auto& rg : header.ReadGroups()) {
                 const auto movie = rg.MovieName();
                 const auto sample = rg.Sample();
@@ -151,25 +148,11 @@ BAM::BamHeader SampleNames::GenerateBamHeader(const AlignSettings& settings, con
             auto r = reader.Next();
             hdr = std::make_unique<BAM::BamHeader>(r.Header().DeepCopy());
         }
+    } else if (uio.isFromStream && !uio.isFastaInput && !uio.isFastqInput) {
+        hdr = std::make_unique<BAM::BamHeader>(uio.stream->BamReader().Header().DeepCopy());
     } else if (!uio.isFastaInput && !uio.isFastqInput) {
-        const auto Fill = [&](const std::string& f) {
-            BAM::DataSet ds{f};
-            const auto bamFiles = ds.BamFiles();
-            if (!hdr) {
-                hdr = std::make_unique<BAM::BamHeader>(bamFiles.front().Header().DeepCopy());
-                for (size_t i = 1; i < bamFiles.size(); ++i)
-                    *hdr += bamFiles.at(i).Header();
-            } else {
-                for (size_t i = 0; i < bamFiles.size(); ++i)
-                    *hdr += bamFiles.at(i).Header();
-            }
-        };
-        if (uio.isFromJson) {
-            Fill(uio.unpackedFromJson);
-        } else {
-            for (const auto& f : uio.inputFiles)
-                Fill(f);
-        };
+        hdr = std::make_unique<BAM::BamHeader>(uio.catalog->MergedHeader(
+            uio.isFromJson ? std::vector<std::string>{uio.unpackedFromJson} : uio.inputFiles));
     } else {
         hdr = std::make_unique<BAM::BamHeader>();
         std::string rgString = settings.Rg;
@@ -210,6 +193,10 @@ BAM::BamHeader SampleNames::GenerateBamHeader(const AlignSettings& settings, con
     auto pg = BAM::ProgramInfo("pbmm2").Name("pbmm2").Version(version).CommandLine("pbmm2 " +
                                                                                    settings.CLI);
     hdr->AddProgram(pg);
+    // marks the output of --shard, such that shards can be gathered
+    if (settings.NumShards > 1)
+        hdr->AddComment("pbmm2-shard:" + std::to_string(settings.ShardIndex + 1) + "/" +
+                        std::to_string(settings.NumShards));
     return hdr->DeepCopy();
 }
 }  // namespace minimap2
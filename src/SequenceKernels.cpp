@@ -0,0 +1,120 @@
+// Author: Armin Töpfer
+
+#include "SequenceKernels.h"
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+
+#ifdef __SSSE3__
+#include <tmmintrin.h>
+#endif
+
+namespace PacBio {
+namespace minimap2 {
+namespace {
+std::array<char, 256> ComplementTable()
+{
+    std::array<char, 256> table;
+    for (int i = 0; i < 256; ++i)
+        table[i] = static_cast<char>(i);
+    const auto Pair = [&table](const char a, const char b) {
+        table[static_cast<uint8_t>(a)] = b;
+        table[static_cast<uint8_t>(b)] = a;
+    };
+    for (const auto& ab : {"AT", "CG", "MK", "RY", "VB", "HD", "at", "cg", "mk", "ry", "vb", "hd"})
+        Pair(ab[0], ab[1]);
+    return table;
+}
+
+const std::array<char, 256> complement = ComplementTable();
+
+inline char Complement(const char c) { return complement[static_cast<uint8_t>(c)]; }
+
+#ifdef __SSSE3__
+const __m128i reverseMask = _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+
+inline __m128i Select(const __m128i mask, const __m128i a, const __m128i b)
+{
+    return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+}
+
+// Complements ACGTN; returns false if the block has other characters
+inline bool ComplementBlock(const __m128i in, __m128i* out)
+{
+    const __m128i a = _mm_cmpeq_epi8(in, _mm_set1_epi8('A'));
+    const __m128i c = _mm_cmpeq_epi8(in, _mm_set1_epi8('C'));
+    const __m128i g = _mm_cmpeq_epi8(in, _mm_set1_epi8('G'));
+    const __m128i t = _mm_cmpeq_epi8(in, _mm_set1_epi8('T'));
+    const __m128i n = _mm_cmpeq_epi8(in, _mm_set1_epi8('N'));
+    const __m128i known = _mm_or_si128(_mm_or_si128(_mm_or_si128(a, c), _mm_or_si128(g, t)), n);
+    if (_mm_movemask_epi8(known) != 0xffff) return false;
+    __m128i r = Select(a, _mm_set1_epi8('T'), in);
+    r = Select(t, _mm_set1_epi8('A'), r);
+    r = Select(c, _mm_set1_epi8('G'), r);
+    *out = Select(g, _mm_set1_epi8('C'), r);
+    return true;
+}
+
+inline __m128i ReverseComplementBlock(const char* src)
+{
+    const __m128i in = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src));
+    __m128i out;
+    if (!ComplementBlock(in, &out)) {
+        alignas(16) char buf[16];
+        for (int i = 0; i < 16; ++i)
+            buf[i] = Complement(src[i]);
+        out = _mm_load_si128(reinterpret_cast<const __m128i*>(buf));
+    }
+    return _mm_shuffle_epi8(out, reverseMask);
+}
+#endif
+}  // namespace
+
+void SequenceKernels::ReverseComplement(std::string* seq)
+{
+    char* data = &(*seq)[0];
+    size_t i = 0;
+    size_t j = seq->size();
+#ifdef __SSSE3__
+    // swap one block from each end per step
+    while (j - i >= 32) {
+        const __m128i front = ReverseComplementBlock(data + i);
+        const __m128i back = ReverseComplementBlock(data + j - 16);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(data + i), back);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(data + j - 16), front);
+        i += 16;
+        j -= 16;
+    }
+#endif
+    while (j > i + 1) {
+        --j;
+        const char c = Complement(data[i]);
+        data[i] = Complement(data[j]);
+        data[j] = c;
+        ++i;
+    }
+    if (j == i + 1) data[i] = Complement(data[i]);
+}
+
+void SequenceKernels::Reverse(std::string* str)
+{
+    char* data = &(*str)[0];
+    size_t i = 0;
+    size_t j = str->size();
+#ifdef __SSSE3__
+    while (j - i >= 32) {
+        const __m128i front = _mm_shuffle_epi8(
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i)), reverseMask);
+        const __m128i back = _mm_shuffle_epi8(
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + j - 16)), reverseMask);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(data + i), back);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(data + j - 16), front);
+        i += 16;
+        j -= 16;
+    }
+#endif
+    std::reverse(data + i, data + j);
+}
+}  // namespace minimap2
+}  // namespace PacBio
@@ -0,0 +1,20 @@
+// Author: Armin Töpfer
+
+#pragma once
+
+#include <string>
+
+namespace PacBio {
+namespace minimap2 {
+/// In-place kernels used when records are flipped to the reverse strand.
+/// With SSSE3, 16 bases are processed per step, otherwise bytewise.
+struct SequenceKernels
+{
+    /// Reverse complement of IUPAC bases, '=' and unknown characters are kept
+    static void ReverseComplement(std::string* seq);
+
+    /// Reverses any string, for example FASTQ-encoded qualities
+    static void Reverse(std::string* str);
+};
+}  // namespace minimap2
+}  // namespace PacBio
@@ -0,0 +1,267 @@
+// Author: Armin Töpfer
+
+#include "StreamInput.h"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstring>
+#include <vector>
+
+#include <pbcopper/logging/Logging.h>
+#include <zlib.h>
+
+#include "AbortException.h"
+
+namespace PacBio {
+namespace minimap2 {
+namespace {
+// Enough to see past a gzip header and a BAM or FASTX start
+constexpr size_t PeekSize = 4096;
+constexpr size_t BlockSize = 1 << 20;
+// How often a followed file is checked for new data
+constexpr int FollowIntervalMs = 1000;
+
+// Empty block that terminates every BGZF file
+const std::string BgzfEofMarker(
+    "\x1f\x8b\x08\x04\x00\x00\x00\x00\x00\xff\x06\x00\x42\x43\x02\x00\x1b\x00\x03\x00"
+    "\x00\x00\x00\x00\x00\x00\x00\x00",
+    28);
+constexpr size_t BgzfHeaderSize = 18;
+
+std::string InflatePrefix(const std::string& in)
+{
+    std::string out(256, '\0');
+    z_stream zs;
+    zs.zalloc = Z_NULL;
+    zs.zfree = Z_NULL;
+    zs.opaque = Z_NULL;
+    zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(in.data()));
+    zs.avail_in = static_cast<uInt>(in.size());
+    zs.next_out = reinterpret_cast<Bytef*>(&out[0]);
+    zs.avail_out = static_cast<uInt>(out.size());
+    // 32 detects the gzip header, BGZF included
+    if (inflateInit2(&zs, 15 + 32) != Z_OK) return {};
+    inflate(&zs, Z_SYNC_FLUSH);
+    out.resize(out.size() - zs.avail_out);
+    inflateEnd(&zs);
+    return out;
+}
+
+InputType DetectType(const std::string& prefix, const std::string& file)
+{
+    const bool gzip = prefix.size() >= 2 && static_cast<unsigned char>(prefix[0]) == 0x1f &&
+                      static_cast<unsigned char>(prefix[1]) == 0x8b;
+    const std::string head = gzip ? InflatePrefix(prefix) : prefix;
+    if (head.compare(0, 4, std::string("BAM\1", 4)) == 0) return InputType::BAM;
+    const auto first = std::find_if_not(head.cbegin(), head.cend(), [](const char c) {
+        return std::isspace(static_cast<unsigned char>(c));
+    });
+    if (first != head.cend() && *first == '>') return InputType::FASTA;
+    if (first != head.cend() && *first == '@') return InputType::FASTQ;
+    throw AbortException("Could not determine the type of input " + file +
+                         ". Streamed input has to be BAM, FASTA, or FASTQ.");
+}
+
+bool WriteAll(const int fd, const char* data, size_t size)
+{
+    while (size > 0) {
+        const ssize_t n = write(fd, data, size);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        data += n;
+        size -= n;
+    }
+    return true;
+}
+}  // namespace
+
+bool StreamInput::IsStream(const std::string& file)
+{
+    if (file == "-") return true;
+    struct stat st;
+    return stat(file.c_str(), &st) == 0 && !S_ISREG(st.st_mode) && !S_ISDIR(st.st_mode);
+}
+
+StreamInput::StreamInput(const std::string& file, const bool follow) : file_(file), follow_(follow)
+{
+    int stopFds[2];
+    if (pipe(stopFds) != 0) throw AbortException("Could not create pipe for input " + file);
+    stopReadFd_ = stopFds[0];
+    stopWriteFd_ = stopFds[1];
+
+    inFd_ = file == "-" ? STDIN_FILENO : open(file.c_str(), O_RDONLY);
+    if (follow_ && inFd_ < 0 && errno == ENOENT) {
+        PBLOG_INFO << "Waiting for input " << file;
+        while (inFd_ < 0 && errno == ENOENT && Wait())
+            inFd_ = open(file.c_str(), O_RDONLY);
+    }
+    if (inFd_ < 0) throw AbortException("Could not open input " + file);
+
+    prefix_.resize(PeekSize);
+    size_t size = 0;
+    while (size < PeekSize) {
+        const size_t n = ReadInput(&prefix_[size], PeekSize - size);
+        if (n == 0) break;
+        size += n;
+    }
+    prefix_.resize(size);
+    type_ = DetectType(prefix_, file);
+    if (follow_ && type_ != InputType::BAM)
+        throw AbortException("Option --follow requires BAM input, " + file + " is not BAM.");
+
+    int fds[2];
+    if (pipe(fds) != 0) throw AbortException("Could not create pipe for input " + file);
+    readFd_ = fds[0];
+    writeFd_ = fds[1];
+#ifdef F_SETPIPE_SZ
+    // fewer context switches between the feeder and the reader, best effort
+    fcntl(writeFd_, F_SETPIPE_SZ, static_cast<int>(BlockSize));
+#endif
+    path_ = "/dev/fd/" + std::to_string(readFd_);
+    feeder_ = std::thread([this]() { Feed(); });
+}
+
+StreamInput::~StreamInput()
+{
+    bamReader_.reset();
+    // a feeder blocked on the pipe sees EPIPE, one blocked on input the stop pipe
+    close(readFd_);
+    close(stopWriteFd_);
+    feeder_.join();
+    close(stopReadFd_);
+    if (inFd_ != STDIN_FILENO) close(inFd_);
+}
+
+const std::string& StreamInput::File() const { return file_; }
+
+const std::string& StreamInput::Path() const { return path_; }
+
+InputType StreamInput::Type() const { return type_; }
+
+BAM::BamReader& StreamInput::BamReader()
+{
+    if (!bamReader_) {
+        try {
+            bamReader_ = std::make_unique<BAM::BamReader>(path_);
+        } catch (const std::exception& e) {
+            throw AbortException("Could not read BAM input " + file_ + ": " + e.what());
+        }
+    }
+    return *bamReader_;
+}
+
+void StreamInput::Feed()
+{
+    // A reader that stopped early has to end the copy with EPIPE,
+    // not terminate the process with SIGPIPE
+    sigset_t sigpipe;
+    sigemptyset(&sigpipe);
+    sigaddset(&sigpipe, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &sigpipe, nullptr);
+
+    std::vector<char> buffer(BlockSize);
+    bool ok = WriteAll(writeFd_, prefix_.data(), prefix_.size());
+    try {
+        while (ok) {
+            const size_t n = ReadInput(buffer.data(), buffer.size());
+            if (n == 0) break;
+            ok = WriteAll(writeFd_, buffer.data(), n);
+        }
+    } catch (const std::exception& e) {
+        PBLOG_ERROR << e.what();
+    }
+    close(writeFd_);
+}
+
+bool StreamInput::Wait()
+{
+    pollfd stop = {stopReadFd_, POLLIN, 0};
+    const int ret = poll(&stop, 1, FollowIntervalMs);
+    return ret == 0 || (ret < 0 && errno == EINTR);
+}
+
+size_t StreamInput::ReadInput(char* data, const size_t size)
+{
+    if (follow_) return ReadFollowed(data, size);
+    while (true) {
+        pollfd fds[2] = {{inFd_, POLLIN, 0}, {stopReadFd_, POLLIN, 0}};
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR) continue;
+            return 0;
+        }
+        if (fds[1].revents != 0) return 0;
+        const ssize_t n = read(inFd_, data, size);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) PBLOG_ERROR << "Could not read input " << file_ << ", it is truncated!";
+        return n > 0 ? n : 0;
+    }
+}
+
+size_t StreamInput::ReadFollowed(char* data, const size_t size)
+{
+    std::vector<char> buffer;
+    while (releasedPos_ == released_.size()) {
+        released_.clear();
+        releasedPos_ = 0;
+        if (finished_) return 0;
+        if (buffer.empty()) buffer.resize(BlockSize);
+        const ssize_t n = read(inFd_, buffer.data(), buffer.size());
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) throw AbortException("Could not read input " + file_);
+        if (n > 0) {
+            waiting_ = false;
+            unreleased_.append(buffer.data(), n);
+            ReleaseBlocks();
+            continue;
+        }
+        // at the current end of the file
+        if (sentinelSeen_) {
+            if (!unreleased_.empty())
+                PBLOG_WARN << "Input " << file_ << " ends with an incomplete BGZF block!";
+            finished_ = true;
+        } else if (access((file_ + ".done").c_str(), F_OK) == 0) {
+            // data may have been appended before the sentinel, read once more
+            sentinelSeen_ = true;
+        } else {
+            if (!waiting_) PBLOG_DEBUG << "Waiting for " << file_ << " to grow";
+            waiting_ = true;
+            if (!Wait()) finished_ = true;
+        }
+    }
+    const size_t n = std::min(size, released_.size() - releasedPos_);
+    std::memcpy(data, released_.data() + releasedPos_, n);
+    releasedPos_ += n;
+    return n;
+}
+
+void StreamInput::ReleaseBlocks()
+{
+    size_t pos = 0;
+    while (unreleased_.size() - pos >= BgzfHeaderSize) {
+        const auto* header = reinterpret_cast<const unsigned char*>(unreleased_.data() + pos);
+        if (header[0] != 0x1f || header[1] != 0x8b || header[3] != 0x04 || header[12] != 'B' ||
+            header[13] != 'C')
+            throw AbortException("Option --follow requires BGZF compressed BAM input, " + file_ +
+                                 " is not.");
+        const size_t blockSize = (header[16] | (header[17] << 8)) + 1;
+        if (unreleased_.size() - pos < blockSize) break;
+        const bool eof = unreleased_.compare(pos, blockSize, BgzfEofMarker) == 0;
+        released_.append(unreleased_, pos, blockSize);
+        pos += blockSize;
+        if (eof) {
+            finished_ = true;
+            break;
+        }
+    }
+    unreleased_.erase(0, pos);
+}
+}  // namespace minimap2
+}  // namespace PacBio
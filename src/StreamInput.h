@@ -0,0 +1,82 @@
+// Author: Armin Töpfer
+
+#pragma once
+
+#include <memory>
+#include <string>
+#include <thread>
+
+#include <pbbam/BamReader.h>
+
+#include "InputOutputUX.h"
+
+namespace PacBio {
+namespace minimap2 {
+/// Read input from stdin or a pipe.
+///
+/// The type is detected from the first bytes of the stream, which cannot be
+/// read twice. A thread replays them, followed by the rest of the stream, into
+/// a pipe that readers open via Path().
+///
+/// With follow, the input is a BGZF file that is still being written. Only
+/// complete blocks are passed on and the stream ends after the EOF marker
+/// block or once the sentinel file <file>.done exists.
+class StreamInput
+{
+public:
+    /// "-", named pipes, and process substitutions
+    static bool IsStream(const std::string& file);
+
+public:
+    explicit StreamInput(const std::string& file, bool follow = false);
+    ~StreamInput();
+
+    StreamInput(const StreamInput&) = delete;
+    StreamInput& operator=(const StreamInput&) = delete;
+
+    const std::string& File() const;
+    const std::string& Path() const;
+
+    /// One of BAM, FASTA, or FASTQ
+    InputType Type() const;
+
+    /// The only reader of BAM input, the header is read on first use
+    BAM::BamReader& BamReader();
+
+private:
+    void Feed();
+    // Returns 0 at the end of the input or once stopped
+    size_t ReadInput(char* data, size_t size);
+    size_t ReadFollowed(char* data, size_t size);
+    // Moves complete blocks of unreleased_ to released_
+    void ReleaseBlocks();
+    // Returns false if stopped
+    bool Wait();
+
+private:
+    const std::string file_;
+    const bool follow_;
+    std::string path_;
+    InputType type_;
+    std::string prefix_;
+
+    int inFd_ = -1;
+    int readFd_ = -1;
+    int writeFd_ = -1;
+    int stopReadFd_ = -1;
+    int stopWriteFd_ = -1;
+    std::thread feeder_;
+
+    // follow: read but incomplete blocks, complete blocks not yet handed out
+    std::string unreleased_;
+    std::string released_;
+    size_t releasedPos_ = 0;
+    bool sentinelSeen_ = false;
+    bool finished_ = false;
+    // at the end of the file, until new data arrives
+    bool waiting_ = false;
+
+    std::unique_ptr<BAM::BamReader> bamReader_;
+};
+}  // namespace minimap2
+}  // namespace PacBio
@@ -2,7 +2,9 @@
 
 #include <limits.h>
 #include <unistd.h>
+#include <cstdio>
 #include <cstdlib>
+#include <exception>
 #include <memory>
 #include <sstream>
 #include <thread>
@@ -19,6 +21,8 @@
 #include <boost/uuid/uuid_io.hpp>
 
 #include "AbortException.h"
+#include "InputCatalog.h"
+#include "PerfCounters.h"
 #include "Timer.h"
 #include "bam_sort.h"
 
@@ -106,6 +110,35 @@ void PrintErrorAndAbort(int error)
     }
     throw AbortException(errMsg);
 }
+
+// Copies the records of unsorted fragments in order, with the header of the first
+void ConcatenateBam(const std::vector<std::string>& files, const std::string& outFile,
+                    const int numThreads)
+{
+    using SamFilePtr = std::unique_ptr<samFile, int (*)(samFile*)>;
+    using HeaderPtr = std::unique_ptr<bam_hdr_t, void (*)(bam_hdr_t*)>;
+    SamFilePtr out(sam_open(outFile.c_str(), "wb"), sam_close);
+    if (!out) throw AbortException("Could not create " + outFile);
+    if (numThreads > 1) hts_set_threads(out.get(), numThreads);
+    HeaderPtr header(nullptr, bam_hdr_destroy);
+    std::unique_ptr<bam1_t, void (*)(bam1_t*)> record(bam_init1(), bam_destroy1);
+    for (const auto& file : files) {
+        SamFilePtr in(sam_open(file.c_str(), "r"), sam_close);
+        HeaderPtr inHeader(in ? sam_hdr_read(in.get()) : nullptr, bam_hdr_destroy);
+        if (!inHeader) throw AbortException("Could not read checkpoint fragment " + file);
+        if (!header) {
+            header = std::move(inHeader);
+            if (sam_hdr_write(out.get(), header.get()) != 0)
+                throw AbortException("Could not write " + outFile);
+        }
+        int ret;
+        while ((ret = sam_read1(in.get(), header.get(), record.get())) >= 0)
+            if (sam_write1(out.get(), header.get(), record.get()) < 0)
+                throw AbortException("Could not write " + outFile);
+        if (ret != -1) throw AbortException("Could not read checkpoint fragment " + file);
+    }
+    if (sam_close(out.release()) != 0) throw AbortException("Could not write " + outFile);
+}
 }  // namespace
 
 StreamWriter::StreamWriter(BAM::BamHeader header, const std::string& outPrefix, bool sort,
@@ -170,9 +203,19 @@ StreamWriter::StreamWriter(BAM::BamHeader header, const std::string& outPrefix,
             } else {
                 PBLOG_DEBUG << "[TMPDIR] Specified directory does not exist: " << tmpdir;
             }
-            int ret = bam_sort(pipeName_.c_str(), finalOutputName_.c_str(), tmpdir.c_str(),
+            // sort workers are spawned by bam_sort, inherit counters to include them
+            std::shared_ptr<PerfCounterGroup> perfGroup;
+            if (PerfCounters::IsEnabled()) {
+                perfGroup = std::make_shared<PerfCounterGroup>(true);
+                PerfCounters::Register(PerfStage::SORT, perfGroup);
+            }
+            int ret;
+            {
+                const PerfScope perf{PerfStage::SORT, perfGroup.get()};
+                ret = bam_sort(pipeName_.c_str(), finalOutputName_.c_str(), tmpdir.c_str(),
                                useTmpDir, sortThreads_, sortThreads_ + numThreads_, sortMemory_,
                                &numFiles, &numBlocks);
+            }
             if (ret == EXIT_FAILURE) {
                 throw AbortException("Fatal error in bam sort. Aborting.");
             }
@@ -185,7 +228,25 @@ StreamWriter::StreamWriter(BAM::BamHeader header, const std::string& outPrefix,
         outputFile = finalOutputName_;
         bamWriterConfig.useTempFile = true;
     }
-    bamWriter_ = std::make_unique<BAM::BamWriter>(outputFile, header_, bamWriterConfig);
+    if (!PerfCounters::IsEnabled()) {
+        bamWriter_ = std::make_unique<BAM::BamWriter>(outputFile, header_, bamWriterConfig);
+        return;
+    }
+    // BGZF compression threads are spawned by the writer, open it from a thread
+    // with inherited counters to include them; they only run while compressing
+    std::exception_ptr error;
+    std::thread([&]() {
+        auto perfGroup = std::make_shared<PerfCounterGroup>(true);
+        PerfCounters::Register(PerfStage::WRITE, perfGroup);
+        if (perfGroup->IsOpen()) perfGroup->Enable();
+        try {
+            bamWriter_ = std::make_unique<BAM::BamWriter>(outputFile, header_, bamWriterConfig);
+        } catch (...) {
+            error = std::current_exception();
+        }
+    })
+        .join();
+    if (error) std::rethrow_exception(error);
 }
 
 void StreamWriter::Write(const BAM::BamRecord& r) const
@@ -282,95 +343,65 @@ StreamWriters::StreamWriters(BAM::BamHeader& header, const std::string& outPrefi
 StreamWriter& StreamWriters::at(const std::string& infix, const std::string& sample)
 {
     static const std::string unsplit = "unsplit";
-    if (!splitBySample_) {
-        if (sampleNameToStreamWriter.find(unsplit) == sampleNameToStreamWriter.cend())
-            sampleNameToStreamWriter.emplace(
-                unsplit,
-                std::make_unique<StreamWriter>(header_.DeepCopy(), outPrefix_, sort_, bamIdx_,
-                                               sortThreads_, numThreads_, sortMemory_));
+    const std::string& key = splitBySample_ ? sample : unsplit;
+    const auto it = sampleNameToStreamWriter.find(key);
+    if (it != sampleNameToStreamWriter.cend()) return *it->second;
 
-        return *sampleNameToStreamWriter.at(unsplit);
+    const std::string writerSample = splitBySample_ ? sample : "";
+    const std::string writerInfix = splitBySample_ ? infix : "";
+    std::unique_ptr<StreamWriter> sw;
+    if (fragmentDir_.empty()) {
+        sw = std::make_unique<StreamWriter>(header_.DeepCopy(), outPrefix_, sort_, bamIdx_,
+                                            sortThreads_, numThreads_, sortMemory_, writerSample,
+                                            writerInfix);
     } else {
-        if (sampleNameToStreamWriter.find(sample) == sampleNameToStreamWriter.cend())
-            sampleNameToStreamWriter.emplace(
-                sample, std::make_unique<StreamWriter>(header_.DeepCopy(), outPrefix_, sort_,
-                                                       bamIdx_, sortThreads_, numThreads_,
-                                                       sortMemory_, sample, infix));
-        return *sampleNameToStreamWriter.at(sample);
+        // fragments are numbered in the order they are opened, across checkpoints
+        char index[16];
+        std::snprintf(index, sizeof(index), "%04zu",
+                      fragments_.size() + sampleNameToStreamWriter.size());
+        sw = std::make_unique<StreamWriter>(header_.DeepCopy(), fragmentDir_ + "/fragment." + index,
+                                            sort_, BamIndex::NONE, sortThreads_, numThreads_,
+                                            sortMemory_, writerSample, writerInfix);
+        openFragments_[key] = OutputFragment{writerSample, writerInfix, sw->FinalOutputName()};
     }
+    return *sampleNameToStreamWriter.emplace(key, std::move(sw)).first->second;
 }
 
 std::string StreamWriters::WriteDatasetsJson(const UserIO& uio, const Summary& s,
                                              const bool splitSample)
 {
-    BAM::DataSet ds;
-    try {
-        if (uio.isFromJson)
-            ds = BAM::DataSet{uio.unpackedFromJson};
-        else if (!uio.isFastaInput && !uio.isFastqInput)
-            ds = BAM::DataSet{uio.inFile};
-    } catch (std::runtime_error& e) {
-        throw AbortException(e.what());
-    }
+    // the input dataset has been parsed at startup
+    static const BAM::DataSet noDataSet;
+    const BAM::DataSet* dsPtr = &noDataSet;
+    if (uio.isFromJson)
+        dsPtr = &uio.catalog->DataSet(uio.unpackedFromJson);
+    else if (!uio.isFastaInput && !uio.isFastqInput && !uio.isFromStream)
+        dsPtr = &uio.catalog->DataSet(uio.inFile);
+    const BAM::DataSet& ds = *dsPtr;
     std::string pbiTiming;
     Timer pbiTimer;
     std::vector<std::string> xmlNames;
     std::vector<std::string> ids;
-    for (auto& sample_sw : sampleNameToStreamWriter) {
-        BAM::BamFile validationBam(sample_sw.second->FinalOutputName());
+    const auto outputs = Outputs();
+    for (const auto& prefix_name : outputs) {
+        BAM::BamFile validationBam(prefix_name.second);
         BAM::PbiFile::CreateFrom(validationBam);
 
         std::string id;
-        const auto xmlName = InputOutputUX::CreateDataSet(
-            ds, uio.refFile, uio.isFromXML, sample_sw.second->FinalOutputPrefix(), uio.outFile, &id,
-            s.NumAlns, s.Bases, uio.bamIndex);
+        const auto xmlName =
+            InputOutputUX::CreateDataSet(ds, uio.refFile, uio.isFromXML, prefix_name.first,
+                                         uio.outFile, &id, s.NumAlns, s.Bases, uio.bamIndex);
         xmlNames.emplace_back(xmlName);
         ids.emplace_back(id);
     }
     pbiTiming = pbiTimer.ElapsedTime();
 
     if (uio.isToJson || splitSample) {
-        JSON::Json datastore;
-        const auto now = BAM::ToIso8601(std::chrono::system_clock::now());
-        datastore["createdAt"] = now;
-        datastore["updatedAt"] = now;
-        datastore["version"] = "0.2.2";
-        std::vector<JSON::Json> files;
-        int i = 0;
-        for (auto& sample_sw : sampleNameToStreamWriter) {
-            JSON::Json datastoreFile;
-            datastoreFile["createdAt"] = now;
-            datastoreFile["description"] = "Aligned and sorted reads as BAM";
-            std::ifstream file(sample_sw.second->FinalOutputName(),
-                               std::ios::binary | std::ios::ate);
-            datastoreFile["fileSize"] = static_cast<int>(file.tellg());
-
-            switch (ds.Type()) {
-                case BAM::DataSet::TypeEnum::SUBREAD:
-                    datastoreFile["fileTypeId"] = "PacBio.DataSet.AlignmentSet";
-                    break;
-                case BAM::DataSet::TypeEnum::CONSENSUS_READ:
-                    datastoreFile["fileTypeId"] = "PacBio.DataSet.ConsensusAlignmentSet";
-                    break;
-                case BAM::DataSet::TypeEnum::TRANSCRIPT:
-                    datastoreFile["fileTypeId"] = "PacBio.DataSet.TranscriptAlignmentSet";
-                    break;
-                default:
-                    throw std::runtime_error("Unsupported input type");
-            }
-
-            datastoreFile["isChunked"] = false;
-            datastoreFile["modifiedAt"] = now;
-            datastoreFile["name"] = "Aligned reads";
-            datastoreFile["path"] = xmlNames[i];
-            datastoreFile["sourceId"] = "mapping.tasks.pbmm2_align-out-1";
-            datastoreFile["uniqueId"] = ids[i];
-            ++i;
-            files.emplace_back(datastoreFile);
-        }
-        datastore["files"] = files;
-        std::ofstream datastoreStream(uio.outPrefix + ".json");
-        datastoreStream << datastore.dump(2);
+        std::vector<std::string> bamFiles;
+        for (const auto& prefix_name : outputs)
+            bamFiles.emplace_back(prefix_name.second);
+        InputOutputUX::WriteDatastore(uio.outPrefix + ".json", ds.Type(),
+                                      "mapping.tasks.pbmm2_align-out-1", bamFiles, xmlNames, ids);
     }
     return pbiTiming;
 }
@@ -378,8 +409,8 @@ std::string StreamWriters::WriteDatasetsJson(const UserIO& uio, const Summary& s
 std::string StreamWriters::ForcePbiOutput()
 {
     Timer pbiTimer;
-    for (auto& sample_sw : sampleNameToStreamWriter) {
-        BAM::BamFile validationBam(sample_sw.second->FinalOutputName());
+    for (const auto& prefix_name : Outputs()) {
+        BAM::BamFile validationBam(prefix_name.second);
         BAM::PbiFile::CreateFrom(validationBam);
     }
     return pbiTimer.ElapsedTime();
@@ -388,6 +419,15 @@ std::string StreamWriters::ForcePbiOutput()
 std::pair<std::string, std::string> StreamWriters::Close()
 {
     CreateEmptyIfNoOutput();
+    constexpr int64_t i641 = 1;
+    if (!fragmentDir_.empty()) {
+        CloseFragments();
+        const int64_t gatherMs = GatherFragments();
+        if (!sort_) return {"", ""};
+        // indices are built while merging
+        return {Timer::ElapsedTimeFromSeconds(std::max(fragmentSortMs_ + gatherMs, i641) * 1e6),
+                ""};
+    }
     int64_t sortMs = 0;
     int64_t idxMs = 0;
     for (auto& sample_sw : sampleNameToStreamWriter) {
@@ -395,7 +435,6 @@ std::pair<std::string, std::string> StreamWriters::Close()
         sortMs += sort_bai.first - sort_bai.second;
         idxMs += sort_bai.second;
     }
-    constexpr int64_t i641 = 1;
     sortMs = std::max(sortMs, i641);
     idxMs = std::max(idxMs, i641);
     if (!sort_)
@@ -407,10 +446,84 @@ std::pair<std::string, std::string> StreamWriters::Close()
 
 void StreamWriters::CreateEmptyIfNoOutput()
 {
-    if (sampleNameToStreamWriter.empty()) {
+    if (sampleNameToStreamWriter.empty() && fragments_.empty()) {
         splitBySample_ = false;
         this->at("", "");
     }
 }
+
+void StreamWriters::UseFragments(const std::string& dir, std::vector<OutputFragment> fragments)
+{
+    fragmentDir_ = dir;
+    fragments_ = std::move(fragments);
+}
+
+const std::vector<OutputFragment>& StreamWriters::CloseFragments()
+{
+    for (auto& sample_sw : sampleNameToStreamWriter) {
+        fragmentSortMs_ += sample_sw.second->Close().first;
+        fragments_.emplace_back(std::move(openFragments_.at(sample_sw.first)));
+    }
+    sampleNameToStreamWriter.clear();
+    openFragments_.clear();
+    return fragments_;
+}
+
+int64_t StreamWriters::GatherFragments()
+{
+    Utility::Stopwatch time;
+    // fragments of each output, in the order they were written
+    std::vector<std::string> samples;
+    std::map<std::string, std::vector<std::string>> sampleFiles;
+    std::map<std::string, std::string> sampleInfix;
+    for (const auto& fragment : fragments_) {
+        if (sampleFiles.find(fragment.Sample) == sampleFiles.cend())
+            samples.emplace_back(fragment.Sample);
+        sampleFiles[fragment.Sample].emplace_back(fragment.File);
+        sampleInfix[fragment.Sample] = fragment.Infix;
+    }
+
+    for (const auto& sample : samples) {
+        const std::string prefix =
+            sample.empty() ? outPrefix_ : outPrefix_ + '.' + sampleInfix[sample];
+        const std::string name = prefix + ".bam";
+        const auto& files = sampleFiles[sample];
+        if (Utility::FileExists(name))
+            PBLOG_WARN << "Warning: Overwriting existing output file: " << name;
+        if (sort_) {
+            // ties are taken from earlier fragments first, as in a single sort
+            std::string indexName;
+            bam_merge_output_t output{-1, nullptr, nullptr, 0, nullptr, nullptr};
+            if (bamIdx_ == BamIndex::BAI) {
+                indexName = name + ".bai";
+                output.index_min_shift = 0;
+            } else if (bamIdx_ == BamIndex::CSI) {
+                indexName = name + ".csi";
+                output.index_min_shift = 14;
+            }
+            if (!indexName.empty()) output.index_name = indexName.c_str();
+            std::vector<char*> names;
+            for (const auto& file : files)
+                names.emplace_back(const_cast<char*>(file.c_str()));
+            if (bam_merge(name.c_str(), static_cast<int>(names.size()), names.data(),
+                          sortThreads_ + numThreads_, &output) != 0)
+                throw AbortException("Could not merge checkpoint fragments into " + name);
+        } else {
+            ConcatenateBam(files, name, numThreads_);
+        }
+        outputs_.emplace_back(prefix, name);
+    }
+    return time.ElapsedMilliseconds();
+}
+
+std::vector<std::pair<std::string, std::string>> StreamWriters::Outputs()
+{
+    if (!fragmentDir_.empty()) return outputs_;
+    std::vector<std::pair<std::string, std::string>> outputs;
+    for (auto& sample_sw : sampleNameToStreamWriter)
+        outputs.emplace_back(sample_sw.second->FinalOutputPrefix(),
+                             sample_sw.second->FinalOutputName());
+    return outputs;
+}
 }  // namespace minimap2
 }  // namespace PacBio
@@ -6,6 +6,7 @@
 #include <memory>
 #include <string>
 #include <tuple>
+#include <vector>
 
 #include "BamIndex.h"
 #include "InputOutputUX.h"
@@ -27,6 +28,14 @@ struct Summary
     std::vector<int32_t> Lengths;
 };
 
+/// Output of one writer between two checkpoints
+struct OutputFragment
+{
+    std::string Sample;
+    std::string Infix;
+    std::string File;
+};
+
 struct StreamWriter
 {
     StreamWriter(BAM::BamHeader header, const std::string& outPrefix, bool sort,
@@ -71,6 +80,18 @@ struct StreamWriters
 
     void CreateEmptyIfNoOutput();
 
+    /// Writes records to fragments in dir, which Close gathers into the final
+    /// output. Fragments of an interrupted run are continued.
+    void UseFragments(const std::string& dir, std::vector<OutputFragment> fragments);
+
+    /// Closes the open fragments, such that all records written so far are on disk
+    const std::vector<OutputFragment>& CloseFragments();
+
+private:
+    // prefix and name of each final output BAM file
+    std::vector<std::pair<std::string, std::string>> Outputs();
+    int64_t GatherFragments();
+
 private:
     BAM::BamHeader header_;
     const std::string& outPrefix_;
@@ -82,6 +103,12 @@ private:
     int64_t sortMemory_;
     std::map<std::string, std::string> movieNameToSampleName;
     std::map<std::string, std::unique_ptr<StreamWriter>> sampleNameToStreamWriter;
+
+    std::string fragmentDir_;
+    std::vector<OutputFragment> fragments_;
+    std::map<std::string, OutputFragment> openFragments_;
+    int64_t fragmentSortMs_ = 0;
+    std::vector<std::pair<std::string, std::string>> outputs_;
 };
 }  // namespace minimap2
 }  // namespace PacBio
@@ -0,0 +1,217 @@
+// Author: Armin Töpfer
+
+#include "ZmwStitcher.h"
+
+#include <algorithm>
+#include <limits>
+#include <vector>
+
+#include <pbbam/BamReader.h>
+#include <pbbam/DataSet.h>
+#include <pbbam/PbiRawData.h>
+#include <pbbam/virtual/ZmwReadStitcher.h>
+
+#include <pbcopper/logging/Logging.h>
+#include <pbcopper/utility/FileUtils.h>
+
+#include "AbortException.h"
+
+namespace PacBio {
+namespace minimap2 {
+namespace {
+// Rows per range, ranges end at ZMW boundaries
+constexpr size_t MinRowsPerRange = 1024;
+constexpr size_t RangesPerThread = 16;
+
+struct StitchSource
+{
+    StitchSource(std::string primaryFile, std::string scrapsFile, BAM::PbiFilter filter)
+        : PrimaryFile(std::move(primaryFile))
+        , ScrapsFile(std::move(scrapsFile))
+        , PrimaryIndex(PrimaryFile + ".pbi")
+        , ScrapsIndex(ScrapsFile + ".pbi")
+        , Filter(std::move(filter))
+    {}
+
+    const std::string PrimaryFile;
+    const std::string ScrapsFile;
+    const BAM::PbiRawData PrimaryIndex;
+    const BAM::PbiRawData ScrapsIndex;
+    const BAM::PbiFilter Filter;
+    // Polymerase read group header as used by BAM::ZmwReadStitcher
+    std::unique_ptr<BAM::BamHeader> Header;
+};
+
+struct ZmwRange
+{
+    size_t PrimaryBegin;
+    size_t PrimaryEnd;
+    size_t ScrapsBegin;
+    size_t ScrapsEnd;
+};
+
+int32_t NextZmw(const std::vector<int32_t>& primary, const size_t p,
+                const std::vector<int32_t>& scraps, const size_t s)
+{
+    return std::min(p < primary.size() ? primary[p] : std::numeric_limits<int32_t>::max(),
+                    s < scraps.size() ? scraps[s] : std::numeric_limits<int32_t>::max());
+}
+
+std::vector<ZmwRange> SplitIntoRanges(const StitchSource& source, const int32_t numThreads)
+{
+    const auto& primary = source.PrimaryIndex.BasicData().holeNumber_;
+    const auto& scraps = source.ScrapsIndex.BasicData().holeNumber_;
+    const size_t rowsPerRange =
+        std::max(MinRowsPerRange, (primary.size() + scraps.size()) /
+                                      (RangesPerThread * std::max<size_t>(1, numThreads)));
+
+    std::vector<ZmwRange> ranges;
+    size_t p = 0;
+    size_t s = 0;
+    while (p < primary.size() || s < scraps.size()) {
+        ZmwRange range{p, p, s, s};
+        while ((p < primary.size() || s < scraps.size()) &&
+               (p - range.PrimaryBegin) + (s - range.ScrapsBegin) < rowsPerRange) {
+            const int32_t zmw = NextZmw(primary, p, scraps, s);
+            while (p < primary.size() && primary[p] == zmw)
+                ++p;
+            while (s < scraps.size() && scraps[s] == zmw)
+                ++s;
+        }
+        range.PrimaryEnd = p;
+        range.ScrapsEnd = s;
+        ranges.emplace_back(range);
+    }
+    return ranges;
+}
+
+void StitchRange(const StitchSource& source, const ZmwRange& range, const bool hqRegion,
+                 const OrderedParallelReader::EmitFunc& emit)
+{
+    const auto Open = [](const std::string& file, const BAM::PbiRawData& index, const size_t begin,
+                         const size_t end) {
+        std::unique_ptr<BAM::BamReader> reader;
+        if (begin == end) return reader;
+        reader = std::make_unique<BAM::BamReader>(file);
+        reader->VirtualSeek(index.BasicData().fileOffset_[begin]);
+        return reader;
+    };
+    auto primaryReader =
+        Open(source.PrimaryFile, source.PrimaryIndex, range.PrimaryBegin, range.PrimaryEnd);
+    auto scrapsReader =
+        Open(source.ScrapsFile, source.ScrapsIndex, range.ScrapsBegin, range.ScrapsEnd);
+
+    // keep decides per row, records are read either way to advance the reader
+    const auto Collect = [](BAM::BamReader* reader, const BAM::PbiRawData& index,
+                            const std::string& file, const int32_t zmw, const size_t end,
+                            size_t* row, const auto& keep, std::vector<BAM::BamRecord>* sources) {
+        const auto& holeNumbers = index.BasicData().holeNumber_;
+        for (; *row < end && holeNumbers[*row] == zmw; ++*row) {
+            BAM::BamRecord record;
+            if (!reader->GetNext(record))
+                throw AbortException("Unexpected end of file " + file + " while stitching ZMW " +
+                                     std::to_string(zmw));
+            if (keep(*row)) sources->emplace_back(std::move(record));
+        }
+    };
+
+    const bool filtered = !source.Filter.IsEmpty();
+    const auto& primary = source.PrimaryIndex.BasicData().holeNumber_;
+    const auto& scraps = source.ScrapsIndex.BasicData().holeNumber_;
+    size_t p = range.PrimaryBegin;
+    size_t s = range.ScrapsBegin;
+    while (p < range.PrimaryEnd || s < range.ScrapsEnd) {
+        const int32_t zmw = NextZmw(primary, p < range.PrimaryEnd ? p : primary.size(), scraps,
+                                    s < range.ScrapsEnd ? s : scraps.size());
+        std::vector<BAM::BamRecord> sources;
+        Collect(primaryReader.get(), source.PrimaryIndex, source.PrimaryFile, zmw, range.PrimaryEnd,
+                &p,
+                [&source, filtered](const size_t row) {
+                    return !filtered || source.Filter.Accepts(source.PrimaryIndex, row);
+                },
+                &sources);
+        // as with BAM::ZmwReadStitcher, the filter selects subreads and thereby
+        // ZMWs, all scraps of a selected ZMW are stitched
+        const bool selected = !filtered || !sources.empty();
+        Collect(scrapsReader.get(), source.ScrapsIndex, source.ScrapsFile, zmw, range.ScrapsEnd, &s,
+                [selected](size_t) { return selected; }, &sources);
+        if (sources.empty()) continue;
+
+        BAM::VirtualZmwBamRecord record(std::move(sources), *source.Header);
+        if (hqRegion && !ZmwStitcher::ClipToHQRegion(record)) continue;
+        emit(std::move(record));
+    }
+}
+}  // namespace
+
+std::unique_ptr<OrderedParallelReader> ZmwStitcher::Create(const std::string& datasetFile,
+                                                           const BAM::PbiFilter& filter,
+                                                           const bool hqRegion,
+                                                           const int32_t numThreads)
+{
+    const BAM::DataSet ds(datasetFile);
+
+    std::vector<std::shared_ptr<StitchSource>> sources;
+    for (const auto& resource : ds.ExternalResources()) {
+        if (resource.MetaType() != "PacBio.SubreadFile.SubreadBamFile") continue;
+        std::string scrapsFile;
+        for (const auto& child : resource.ExternalResources())
+            if (child.MetaType() == "PacBio.SubreadFile.ScrapsBamFile")
+                scrapsFile = ds.ResolvePath(child.ResourceId());
+        const std::string primaryFile = ds.ResolvePath(resource.ResourceId());
+        if (scrapsFile.empty() || !Utility::FileExists(primaryFile + ".pbi") ||
+            !Utility::FileExists(scrapsFile + ".pbi")) {
+            PBLOG_TRACE << "Missing scraps or .pbi for " << primaryFile
+                        << ", ZMW reads are stitched on a single thread";
+            return nullptr;
+        }
+
+        auto source = std::make_shared<StitchSource>(primaryFile, scrapsFile, filter);
+        const auto& primary = source->PrimaryIndex.BasicData().holeNumber_;
+        const auto& scraps = source->ScrapsIndex.BasicData().holeNumber_;
+        if (!std::is_sorted(primary.cbegin(), primary.cend()) ||
+            !std::is_sorted(scraps.cbegin(), scraps.cend())) {
+            PBLOG_TRACE << primaryFile
+                        << " is not sorted by hole number, ZMW reads are stitched on a single "
+                           "thread";
+            return nullptr;
+        }
+
+        // The stitcher derives the polymerase read group, reuse it for all ranges
+        BAM::ZmwReadStitcher probe(primaryFile, scrapsFile);
+        if (!probe.HasNext()) continue;
+        source->Header = std::make_unique<BAM::BamHeader>(probe.Next().Header());
+        sources.emplace_back(std::move(source));
+    }
+
+    std::vector<OrderedParallelReader::Task> tasks;
+    for (const auto& source : sources) {
+        for (const auto& range : SplitIntoRanges(*source, numThreads)) {
+            tasks.emplace_back(
+                [source, range, hqRegion](const OrderedParallelReader::EmitFunc& emit) {
+                    StitchRange(*source, range, hqRegion, emit);
+                });
+        }
+    }
+    PBLOG_TRACE << "Stitching ZMW reads in " << tasks.size() << " ranges using " << numThreads
+                << " threads";
+    return std::make_unique<OrderedParallelReader>(std::move(tasks), numThreads);
+}
+
+bool ZmwStitcher::ClipToHQRegion(BAM::VirtualZmwBamRecord& record)
+{
+    if (!record.HasVirtualRegionType(BAM::VirtualRegionType::HQREGION)) return true;
+    const auto hqs = record.VirtualRegionsTable(BAM::VirtualRegionType::HQREGION);
+    if (hqs.empty()) {
+        PBLOG_WARN << "Skipping ZMW record " << record.FullName() << " missing HQ region";
+        return false;
+    }
+    if (hqs.size() > 1) {
+        PBLOG_WARN << "ZMW record " << record.FullName()
+                   << " has more than one HQ region, will use first";
+    }
+    record.Clip(BAM::ClipType::CLIP_TO_QUERY, hqs.at(0).beginPos, hqs.at(0).endPos);
+    return true;
+}
+}  // namespace minimap2
+}  // namespace PacBio
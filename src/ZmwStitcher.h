@@ -0,0 +1,36 @@
+// Author: Armin Töpfer
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include <pbbam/PbiFilter.h>
+#include <pbbam/virtual/VirtualZmwBamRecord.h>
+
+#include "OrderedParallelReader.h"
+
+namespace PacBio {
+namespace minimap2 {
+/// Stitches the ZMW reads of a subreadset on multiple threads. ZMW ranges are
+/// derived from the subreads and scraps .pbi files, each range is read via
+/// virtual file offsets by its own pair of readers. Reads are returned in the
+/// same order as BAM::ZmwReadStitcher.
+class ZmwStitcher
+{
+public:
+    /// filter is applied to the PBI rows of subreads, scraps are kept for
+    /// every ZMW with a selected subread. numThreads is the share of -j that
+    /// stitching may use, next to the align workers.
+    /// Returns nullptr if a resource lacks scraps, a .pbi file, or is not
+    /// sorted by hole number; callers then fall back to BAM::ZmwReadStitcher.
+    static std::unique_ptr<OrderedParallelReader> Create(const std::string& datasetFile,
+                                                         const BAM::PbiFilter& filter,
+                                                         bool hqRegion, int32_t numThreads);
+
+    /// Clips to the first HQ region, returns false if the record has to be skipped
+    static bool ClipToHQRegion(BAM::VirtualZmwBamRecord& record);
+};
+}  // namespace minimap2
+}  // namespace PacBio
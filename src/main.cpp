@@ -12,6 +12,8 @@
 #include "AlignWorkflow.h"
 #include "IndexSettings.h"
 #include "IndexWorkflow.h"
+#include "MergeSettings.h"
+#include "MergeWorkflow.h"
 
 PacBio::CLI_v2::MultiToolInterface CreateMultiInterface()
 {
@@ -26,7 +28,10 @@ PacBio::CLI_v2::MultiToolInterface CreateMultiInterface()
            &PacBio::minimap2::IndexWorkflow::Runner},
         {"align",
             PacBio::minimap2::AlignSettings::CreateCLI(),
-           &PacBio::minimap2::AlignWorkflow::Runner}
+           &PacBio::minimap2::AlignWorkflow::Runner},
+        {"merge",
+            PacBio::minimap2::MergeSettings::CreateCLI(),
+           &PacBio::minimap2::MergeWorkflow::Runner}
     });
 
     mi.HelpFooter(
@@ -45,7 +50,12 @@ R"(Typical workflows:
      $ pbmm2 align hg38.mmi movie1.subreadset.xml | samtools sort > hg38.movie1.sorted.bam
 
   E. Align CCS fastq input and sort on-the-fly
-     $ pbmm2 align ref.fasta movie.Q20.fastq ref.movie.bam --preset CCS --sort --rg '@RG\tID:myid\tSM:mysample')");
+     $ pbmm2 align ref.fasta movie.Q20.fastq ref.movie.bam --preset CCS --sort --rg '@RG\tID:myid\tSM:mysample'
+
+  F. Align one input on two nodes and gather the sorted shards
+     $ pbmm2 align ref.mmi movie.subreadset.xml shard1.bam --sort --shard 1/2
+     $ pbmm2 align ref.mmi movie.subreadset.xml shard2.bam --sort --shard 2/2
+     $ pbmm2 merge shard1.bam shard2.bam ref.movie.alignmentset.xml)");
 
     // clang-format on
     return mi;
@@ -441,6 +441,164 @@ Test bam_sort
 Test that median filter does not fail
   $ $__PBTEST_PBMM2_EXE align $IN $REF $CRAMTMP/median_output.bam --median-filter
 
+Test that median filter picks the same subreads with and without .pbi
+  $ TINY=$TESTDIR/data/m54019_171011_032401_tiny.subreads.bam
+  $ LAMBDA=$TESTDIR/data/lambdaNEB_BsaAI_allFrags_incLeftRightEnds_unrolled_250k.fasta
+  $ cp $TINY $CRAMTMP/median_nopbi.subreads.bam
+  $ $__PBTEST_PBMM2_EXE align $TINY $LAMBDA $CRAMTMP/median_pbi.bam --median-filter
+  $ $__PBTEST_PBMM2_EXE align $CRAMTMP/median_nopbi.subreads.bam $LAMBDA $CRAMTMP/median_nopbi.bam --median-filter
+  $ samtools view $CRAMTMP/median_pbi.bam | cut -f 1 > $CRAMTMP/median_pbi.txt
+  $ samtools view $CRAMTMP/median_nopbi.bam | cut -f 1 > $CRAMTMP/median_nopbi.txt
+  $ diff $CRAMTMP/median_pbi.txt $CRAMTMP/median_nopbi.txt
+
+Test that input filters select the same reads with and without .pbi
+  $ $__PBTEST_PBMM2_EXE align $TINY $LAMBDA $CRAMTMP/filter_pbi.bam --min-read-length 1000 --max-read-length 20000
+  $ $__PBTEST_PBMM2_EXE align $CRAMTMP/median_nopbi.subreads.bam $LAMBDA $CRAMTMP/filter_nopbi.bam --min-read-length 1000 --max-read-length 20000
+  $ samtools view $CRAMTMP/filter_pbi.bam | cut -f 1 > $CRAMTMP/filter_pbi.txt
+  $ samtools view $CRAMTMP/filter_nopbi.bam | cut -f 1 > $CRAMTMP/filter_nopbi.txt
+  $ diff $CRAMTMP/filter_pbi.txt $CRAMTMP/filter_nopbi.txt
+  $ $__PBTEST_PBMM2_EXE align $TINY $LAMBDA $CRAMTMP/filter_movie.bam --include-movies unknown_movie
+  $ samtools view $CRAMTMP/filter_movie.bam | wc -l | tr -d ' '
+  0
+
+Test read cap and deterministic subsampling
+  $ $__PBTEST_PBMM2_EXE align $IN $REF $CRAMTMP/maxreads.bam --max-reads 5 --unmapped
+  $ samtools view $CRAMTMP/maxreads.bam | cut -f 1 | sort -u | wc -l | tr -d ' '
+  5
+  $ $__PBTEST_PBMM2_EXE align $IN $REF $CRAMTMP/subsample1.bam --subsample 0.5 --unmapped
+  $ $__PBTEST_PBMM2_EXE align $IN $REF $CRAMTMP/subsample2.bam --subsample 0.5 --unmapped -j 1
+  $ samtools view $CRAMTMP/subsample1.bam | cut -f 1 | sort -u > $CRAMTMP/subsample1.txt
+  $ samtools view $CRAMTMP/subsample2.bam | cut -f 1 | sort -u > $CRAMTMP/subsample2.txt
+  $ diff $CRAMTMP/subsample1.txt $CRAMTMP/subsample2.txt
+
+Test that the read cap is spread across an input with .pbi, instead of taking its first reads,
+and counts only reads that pass the filters and the shard
+  $ CCS=$TESTDIR/data/m54075_180905_221350.ccs.bam
+  $ $__PBTEST_PBMM2_EXE align $CCS $REF $CRAMTMP/maxreads_pbi.bam --max-reads 3 --unmapped
+  $ samtools view $CRAMTMP/maxreads_pbi.bam | cut -f 1 | sort -u
+  m54075_180905_221350/4325872/ccs
+  m54075_180905_221350/4325958/ccs
+  m54075_180905_221350/4457025/ccs
+  $ $__PBTEST_PBMM2_EXE align $CCS $REF $CRAMTMP/maxreads_minlen.bam --max-reads 3 --min-read-length 1000 --unmapped
+  $ samtools view $CRAMTMP/maxreads_minlen.bam | cut -f 1 | sort -u
+  m54075_180905_221350/4456990/ccs
+  m54075_180905_221350/4457025/ccs
+  m54075_180905_221350/4457052/ccs
+  $ $__PBTEST_PBMM2_EXE align $CCS $REF $CRAMTMP/maxreads_shard.bam --max-reads 2 --shard 2/3 --unmapped
+  $ samtools view $CRAMTMP/maxreads_shard.bam | cut -f 1 | sort -u
+  m54075_180905_221350/4325958/ccs
+  m54075_180905_221350/4391555/ccs
+
+Test disjoint shards that keep ZMWs together
+  $ $__PBTEST_PBMM2_EXE align $IN $REF $CRAMTMP/shard_all.bam --unmapped
+  $ $__PBTEST_PBMM2_EXE align $IN $REF $CRAMTMP/shard1.bam --unmapped --shard 1/2
+  $ $__PBTEST_PBMM2_EXE align $IN $REF $CRAMTMP/shard2.bam --unmapped --shard 2/2
+  $ samtools view -H $CRAMTMP/shard2.bam | grep -c "@CO.pbmm2-shard:2/2"
+  1
+  $ samtools view $CRAMTMP/shard1.bam | cut -f 1 | cut -d / -f 1-2 | sort -u > $CRAMTMP/shard1.txt
+  $ samtools view $CRAMTMP/shard2.bam | cut -f 1 | cut -d / -f 1-2 | sort -u > $CRAMTMP/shard2.txt
+  $ comm -12 $CRAMTMP/shard1.txt $CRAMTMP/shard2.txt | wc -l | tr -d ' '
+  0
+  $ samtools view $CRAMTMP/shard_all.bam | cut -f 1 | cut -d / -f 1-2 | sort -u > $CRAMTMP/shard_all.txt
+  $ sort -u $CRAMTMP/shard1.txt $CRAMTMP/shard2.txt | diff - $CRAMTMP/shard_all.txt
+  $ $__PBTEST_PBMM2_EXE align $IN $REF $CRAMTMP/shard3.bam --shard 3/2
+  *Option --shard must be of the form i/N with 1 <= i <= N.* (glob)
+  [1]
+
+Test that record range shards of an input with .pbi add up to the unsharded output
+  $ $__PBTEST_PBMM2_EXE align $CCS $REF $CRAMTMP/ccs_shard_all.bam --unmapped
+  $ for i in 1 2 3; do $__PBTEST_PBMM2_EXE align $CCS $REF $CRAMTMP/ccs_shard$i.bam --unmapped --shard $i/3; done
+  $ for i in 1 2 3; do samtools view $CRAMTMP/ccs_shard$i.bam | cut -f 1 | sort -u | wc -l | tr -d ' '; done
+  4
+  4
+  4
+  $ for i in 1 2 3; do samtools view $CRAMTMP/ccs_shard$i.bam; done | sort | diff - <(samtools view $CRAMTMP/ccs_shard_all.bam | sort)
+  $ echo $CCS > $CRAMTMP/ccs_twice.fofn
+  $ echo $CCS >> $CRAMTMP/ccs_twice.fofn
+  $ $__PBTEST_PBMM2_EXE align $CRAMTMP/ccs_twice.fofn $REF $CRAMTMP/ccs_twice.bam --unmapped --shard 1/2
+  *Cannot use --shard with input that lists * more than once!* (glob)
+  [1]
+
+Test gathering sorted shards
+  $ $__PBTEST_PBMM2_EXE align $IN $REF $CRAMTMP/gather_all.bam --sort
+  $ $__PBTEST_PBMM2_EXE align $IN $REF $CRAMTMP/gather1.bam --sort --pbi --shard 1/2
+  $ $__PBTEST_PBMM2_EXE align $IN $REF $CRAMTMP/gather2.bam --sort --pbi --shard 2/2
+  $ $__PBTEST_PBMM2_EXE merge $CRAMTMP/gather1.bam $CRAMTMP/gather2.bam $CRAMTMP/gather.alignmentset.xml
+  $ ls -alh $CRAMTMP/gather.bam.pbi 2> /dev/null | wc -l | tr -d ' '
+  1
+  $ ls -alh $CRAMTMP/gather.bam.bai 2> /dev/null | wc -l | tr -d ' '
+  1
+  $ ls -alh $CRAMTMP/gather.bam.gzi 2> /dev/null | wc -l | tr -d ' '
+  0
+  $ samtools view -H $CRAMTMP/gather.bam | grep "@HD" | grep -c "coordinate"
+  1
+  $ samtools view $CRAMTMP/gather.bam | sort > $CRAMTMP/gather.txt
+  $ samtools view $CRAMTMP/gather_all.bam | sort | diff - $CRAMTMP/gather.txt
+  $ cp $CRAMTMP/gather.bam $CRAMTMP/gather_copy.bam
+  $ pbindex $CRAMTMP/gather_copy.bam
+  $ pbindexdump $CRAMTMP/gather_copy.bam.pbi | diff - <(pbindexdump $CRAMTMP/gather.bam.pbi)
+  $ $__PBTEST_PBMM2_EXE merge $CRAMTMP/gather1.bam $CRAMTMP/gather_one.bam 2>&1 | grep -c "Shard 2/2 is missing"
+  1
+  $ $__PBTEST_PBMM2_EXE merge $CRAMTMP/unsorted.bam $CRAMTMP/gather_unsorted.bam 2>&1
+  *is not sorted by coordinate* (glob)
+  [1]
+
+Test checkpoints
+  $ $__PBTEST_PBMM2_EXE align $IN $REF $CRAMTMP/checkpoint.bam --sort --checkpoint-interval 10
+  $ ls -d $CRAMTMP/checkpoint.pbmm2.checkpoint 2> /dev/null | wc -l | tr -d ' '
+  0
+  $ ls -alh $CRAMTMP/checkpoint.bam.bai 2> /dev/null | wc -l | tr -d ' '
+  1
+  $ samtools view $CRAMTMP/gather_all.bam > $CRAMTMP/gather_all.txt
+  $ samtools view $CRAMTMP/checkpoint.bam | diff - $CRAMTMP/gather_all.txt
+  $ $__PBTEST_PBMM2_EXE align $IN $REF $CRAMTMP/checkpoint_unsorted.bam --checkpoint-interval 10
+  $ samtools view $CRAMTMP/unsorted.bam > $CRAMTMP/unsorted.txt
+  $ samtools view $CRAMTMP/checkpoint_unsorted.bam | diff - $CRAMTMP/unsorted.txt
+  $ $__PBTEST_PBMM2_EXE align $IN $REF $CRAMTMP/resumed.bam --resume 2>&1
+  *Cannot resume, there is no checkpoint in* (glob)
+  [1]
+  $ $__PBTEST_PBMM2_EXE align $IN $REF --checkpoint-interval 10 2>&1
+  *Options --checkpoint-interval and --resume require an output file.* (glob)
+  [1]
+
+Test resuming a run that stopped right after its first checkpoint
+  $ $__PBTEST_PBMM2_EXE align $IN $REF $CRAMTMP/interrupted.bam --sort --chunk-size 5 --chunk-bases 1G --checkpoint-chunks 2 --stop-after-checkpoint 2>&1 | grep -c "Stopped after checkpoint"
+  1
+  $ ls $CRAMTMP/interrupted.pbmm2.checkpoint
+  fragment.0000.bam
+  state.json
+  $ grep -c '"numInputReads": 10,' $CRAMTMP/interrupted.pbmm2.checkpoint/state.json
+  1
+  $ $__PBTEST_PBMM2_EXE align $IN $REF $CRAMTMP/interrupted.bam --sort --chunk-size 5 --chunk-bases 1G --resume
+  $ ls -d $CRAMTMP/interrupted.pbmm2.checkpoint 2> /dev/null | wc -l | tr -d ' '
+  0
+  $ samtools view -h $CRAMTMP/checkpoint.bam | grep -v "^@PG" > $CRAMTMP/checkpoint.txt
+  $ samtools view -h $CRAMTMP/interrupted.bam | grep -v "^@PG" | diff - $CRAMTMP/checkpoint.txt
+  $ $__PBTEST_PBMM2_EXE align $IN $REF $CRAMTMP/interrupted_unsorted.bam --chunk-size 5 --chunk-bases 1G --checkpoint-chunks 2 --stop-after-checkpoint 2>&1 | grep -c "Stopped after checkpoint"
+  1
+  $ $__PBTEST_PBMM2_EXE align $IN $REF $CRAMTMP/interrupted_unsorted.bam --chunk-size 5 --chunk-bases 1G --resume
+  $ samtools view -h $CRAMTMP/checkpoint_unsorted.bam | grep -v "^@PG" > $CRAMTMP/checkpoint_unsorted.txt
+  $ samtools view -h $CRAMTMP/interrupted_unsorted.bam | grep -v "^@PG" | diff - $CRAMTMP/checkpoint_unsorted.txt
+  $ $__PBTEST_PBMM2_EXE align $IN $REF $CRAMTMP/interrupted_minlen.bam --chunk-size 5 --chunk-bases 1G --checkpoint-chunks 2 --stop-after-checkpoint 2>&1 | grep -c "Stopped after checkpoint"
+  1
+  $ $__PBTEST_PBMM2_EXE align $IN $REF $CRAMTMP/interrupted_minlen.bam --chunk-size 5 --chunk-bases 1G --resume --min-read-length 1000 2>&1
+  *was taken with different input, reference, or output options* (glob)
+  [1]
+  $ $__PBTEST_PBMM2_EXE align $IN $REF $CRAMTMP/interrupted_minlen.bam --chunk-size 5 --chunk-bases 1G --resume --best-n 1 2>&1
+  *was taken with different input, reference, or output options* (glob)
+  [1]
+  $ $__PBTEST_PBMM2_EXE align $IN $REF $CRAMTMP/interrupted_minlen.bam --chunk-size 5 --chunk-bases 1G --resume --min-id-perc 90 2>&1
+  *was taken with different input, reference, or output options* (glob)
+  [1]
+  $ grep -o 'best-n=0\\n' $CRAMTMP/interrupted_minlen.pbmm2.checkpoint/state.json
+  best-n=0\n
+
+Test mapping-only PAF output
+  $ $__PBTEST_PBMM2_EXE align $IN $REF $CRAMTMP/mapping.paf --mapping-only
+  $ test -s $CRAMTMP/mapping.paf
+  $ awk -F '\t' 'NF < 12 || $4 <= $3 || $9 <= $8 || $12 > 255' $CRAMTMP/mapping.paf | wc -l | tr -d ' '
+  0
+
   $ $__PBTEST_PBMM2_EXE align $IN $REF $CRAMTMP/bestn1.bam --best-n 1
   $ samtools view $CRAMTMP/bestn1.bam | wc -l | tr -d ' '
   52
@@ -460,3 +618,26 @@ Test that median filter does not fail
   0
   $ ls -alh $CRAMTMP/rle.ref.collapsed.fasta 2> /dev/null | wc -l | tr -d ' '
   1
+
+  $ $__PBTEST_PBMM2_EXE align $IN $REF $CRAMTMP/file.bam
+  $ samtools view $CRAMTMP/file.bam > $CRAMTMP/file.txt
+
+Test that --follow waits for new blocks until the sentinel file exists;
+the input is written in two steps without the BGZF EOF marker and each
+step waits until pbmm2 logged that it reached the current end of the file
+  $ WaitForLines() { for i in $(seq 600); do [ "$(grep -c "to grow" $CRAMTMP/follow.log 2> /dev/null)" -ge $1 ] && return 0; sleep 0.1; done; return 1; }
+  $ SIZE=$(($(wc -c < $IN) - 28))
+  $ head -c 1000 $IN > $CRAMTMP/growing.bam
+  $ $__PBTEST_PBMM2_EXE align $CRAMTMP/growing.bam $REF $CRAMTMP/followed.bam --follow --log-level DEBUG --log-file $CRAMTMP/follow.log &
+  $ PID=$!
+  $ WaitForLines 1
+  $ head -c $SIZE $IN | tail -c +1001 >> $CRAMTMP/growing.bam
+  $ WaitForLines 2
+  $ kill -0 $PID
+  $ touch $CRAMTMP/growing.bam.done
+  $ wait $PID
+  $ samtools view $CRAMTMP/followed.bam | diff - $CRAMTMP/file.txt
+  $ $__PBTEST_PBMM2_EXE align $REF $TESTDIR/data/bnd.fasta $CRAMTMP/followed.bam --follow
+  *Input is FASTA.* (glob)
+  *Option --follow requires a BAM file as input.* (glob)
+  [1]
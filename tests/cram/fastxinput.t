@@ -708,3 +708,63 @@
   *Run Time: * (glob)
   *CPU Time: * (glob)
   *Peak RSS: * (glob)
+
+  $ fold -w 60 $FASTA > $CRAMTMP/median_wrapped.fasta
+  $ $__PBTEST_PBMM2_EXE align $REF $FASTA $CRAMTMP/fasta_lines.bam
+  *Input is FASTA.* (glob)
+  $ $__PBTEST_PBMM2_EXE align $REF $CRAMTMP/median_wrapped.fasta $CRAMTMP/fasta_wrapped.bam
+  *Input is FASTA.* (glob)
+  $ samtools view $CRAMTMP/fasta_lines.bam | cut -f 1-10 > $CRAMTMP/fasta_lines.txt
+  $ samtools view $CRAMTMP/fasta_wrapped.bam | cut -f 1-10 | diff - $CRAMTMP/fasta_lines.txt
+  $ $__PBTEST_PBMM2_EXE align $REF $FASTQ $CRAMTMP/fastq_plain.bam -j 4
+  *Input is FASTQ.* (glob)
+  $ $__PBTEST_PBMM2_EXE align $REF $FASTQGZ $CRAMTMP/fastq_gzip.bam -j 4
+  *Input is FASTQ.* (glob)
+  $ samtools view $CRAMTMP/fastq_plain.bam | cut -f 1-11 > $CRAMTMP/fastq_plain.txt
+  $ samtools view $CRAMTMP/fastq_gzip.bam | cut -f 1-11 | diff - $CRAMTMP/fastq_plain.txt
+  $ bgzip -c $FASTQ > $CRAMTMP/median_bgzip.fastq.gz
+  $ $__PBTEST_PBMM2_EXE align $REF $CRAMTMP/median_bgzip.fastq.gz $CRAMTMP/fastq_bgzip.bam -j 4
+  *Input is FASTQ.* (glob)
+  $ samtools view $CRAMTMP/fastq_bgzip.bam | cut -f 1-11 | diff - $CRAMTMP/fastq_plain.txt
+
+  $ for i in 1 2 3; do $__PBTEST_PBMM2_EXE align $REF $FASTQ $CRAMTMP/fastq_shard$i.bam --shard $i/3; done 2>&1 | grep -c "Input is FASTQ"
+  3
+  $ for i in 1 2 3; do samtools view $CRAMTMP/fastq_shard$i.bam | cut -f 1-11; done | sort | diff - <(sort $CRAMTMP/fastq_plain.txt)
+  $ for i in 1 2 3; do $__PBTEST_PBMM2_EXE align $REF $FASTQGZ $CRAMTMP/fastqgz_shard$i.bam --shard $i/3; done 2>&1 | grep -c "Input is FASTQ"
+  3
+  $ for i in 1 2 3; do samtools view $CRAMTMP/fastqgz_shard$i.bam | cut -f 1-11; done | sort | diff - <(sort $CRAMTMP/fastq_plain.txt)
+
+  $ cat $FASTQGZ | $__PBTEST_PBMM2_EXE align $REF - $CRAMTMP/fastq_stdin.bam -j 4
+  *Input is FASTQ.* (glob)
+  $ samtools view $CRAMTMP/fastq_stdin.bam | cut -f 1-11 | diff - $CRAMTMP/fastq_plain.txt
+  $ $__PBTEST_PBMM2_EXE align $REF <(cat $FASTA) $CRAMTMP/fasta_pipe.bam
+  *Input is FASTA.* (glob)
+  $ samtools view $CRAMTMP/fasta_pipe.bam | cut -f 1-10 | diff - $CRAMTMP/fasta_lines.txt
+  $ $__PBTEST_PBMM2_EXE align $REF $BAM $CRAMTMP/bam_file.bam
+  $ cat $BAM | $__PBTEST_PBMM2_EXE align $REF - $CRAMTMP/bam_stdin.bam
+  $ samtools view $CRAMTMP/bam_file.bam > $CRAMTMP/bam_file.txt
+  $ samtools view $CRAMTMP/bam_stdin.bam | diff - $CRAMTMP/bam_file.txt
+  $ echo "not reads" | $__PBTEST_PBMM2_EXE align $REF - $CRAMTMP/unknown_stdin.bam
+  *Could not determine the type of input -. Streamed input has to be BAM, FASTA, or FASTQ.* (glob)
+  [1]
+
+Test that --max-coverage caps the depth and stops reading early
+  $ $__PBTEST_PBMM2_EXE align $TESTDIR/data/synth.ref.fasta $TESTDIR/data/synth5k.fasta.gz $CRAMTMP/maxcov.bam --max-coverage 2 --chunk-size 5 --chunk-bases 1G -j 1 --log-level INFO --log-file $CRAMTMP/maxcov.log
+  $ samtools view $CRAMTMP/maxcov.bam | wc -l | tr -d ' '
+  7
+  $ samtools view $CRAMTMP/maxcov.bam | cut -f 6 | grep -o '[0-9]*=' | tr -d = | awk '{ n += $1 } END { print n }'
+  10000
+  $ samtools view $CRAMTMP/maxcov.bam | cut -f 1 | sort -u | wc -l | tr -d ' '
+  5
+  $ grep -c "Mapped Reads: 5$" $CRAMTMP/maxcov.log
+  1
+  $ grep "stopped reading after" $CRAMTMP/maxcov.log | sed 's/.*after \([0-9]*\) input reads.*/\1/' | awk '{ print ($1 < 50) }'
+  1
+
+Test that --perf-counters reports each stage with the metrics, or is ignored where perf_event_open is denied
+  $ $__PBTEST_PBMM2_EXE align $REF $FASTA $CRAMTMP/perf.bam --perf-counters --log-level INFO --log-file $CRAMTMP/perf.log
+  $ grep -c -e "Perf Counters mm_map: instructions" -e "Hardware performance counters are not available" $CRAMTMP/perf.log
+  1
+  $ grep -c -e "Perf Counters BAM Writing: instructions" -e "Hardware performance counters are not available" $CRAMTMP/perf.log
+  1
+  $ diff <(samtools view $CRAMTMP/fasta_unsorted.bam) <(samtools view $CRAMTMP/perf.bam)
@@ -121,10 +121,12 @@
   Tools:
     index      Index reference and store as .mmi file
     align      Align PacBio reads to reference sequences
+    merge      Merge coordinate-sorted BAM files and index them
   * (glob)
   Examples:
     pbmm2 index ref.referenceset.xml ref.mmi
     pbmm2 align ref.referenceset.xml movie.subreadset.xml ref.movie.alignmentset.xml
+    pbmm2 merge shard1.alignmentset.xml shard2.alignmentset.xml merged.alignmentset.xml
   * (glob)
   Typical workflows:
     A. Generate index file for reference and reuse it to align reads
@@ -142,6 +144,11 @@
   * (glob)
     E. Align CCS fastq input and sort on-the-fly
        $ pbmm2 align ref.fasta movie.Q20.fastq ref.movie.bam --preset CCS --sort --rg '@RG\tID:myid\tSM:mysample'
+  * (glob)
+    F. Align one input on two nodes and gather the sorted shards
+       $ pbmm2 align ref.mmi movie.subreadset.xml shard1.bam --sort --shard 1/2
+       $ pbmm2 align ref.mmi movie.subreadset.xml shard2.bam --sort --shard 2/2
+       $ pbmm2 merge shard1.bam shard2.bam ref.movie.alignmentset.xml
 
   $ $__PBTEST_PBMM2_EXE --help 2>&1 | head -n 1
   pbmm2 - minimap2 with native PacBio BAM support* (glob)
@@ -303,6 +310,21 @@
   *READ input file: *median.fastq* (glob)
   *REF  input file: *ecoli.referenceset.xml* (glob)
 
+  $ echo $BAM > $CRAMTMP/three-bams.fofn
+  $ echo $IN >> $CRAMTMP/three-bams.fofn
+  $ echo $BAM >> $CRAMTMP/three-bams.fofn
+  $ i=0; for f in $BAM $IN $BAM; do i=$((i+1)); $__PBTEST_PBMM2_EXE align $f $REF $CRAMTMP/one-bam$i.bam -j 2 && samtools view $CRAMTMP/one-bam$i.bam; done > $CRAMTMP/three-bams-single.txt
+  $ $__PBTEST_PBMM2_EXE align $CRAMTMP/three-bams.fofn $REF $CRAMTMP/three-bams-seq.bam --max-open-files 1 -j 2
+  $ samtools view $CRAMTMP/three-bams-seq.bam | diff - $CRAMTMP/three-bams-single.txt
+  $ $__PBTEST_PBMM2_EXE align $CRAMTMP/three-bams.fofn $REF $CRAMTMP/three-bams-two.bam --max-open-files 2 -j 2
+  $ samtools view $CRAMTMP/three-bams-two.bam | diff - $CRAMTMP/three-bams-single.txt
+  $ $__PBTEST_PBMM2_EXE align $CRAMTMP/three-bams.fofn $REF $CRAMTMP/three-bams-par.bam --max-open-files 3 -j 2
+  $ samtools view $CRAMTMP/three-bams-par.bam | diff - $CRAMTMP/three-bams-single.txt
+
+  $ $__PBTEST_PBMM2_EXE align $CRAMTMP/three-bams.fofn $REF $CRAMTMP/three-bams-par.bam --max-open-files 0
+  *Option --max-open-files must be at least 1.* (glob)
+  [1]
+
   $ echo $BAM > $CRAMTMP/mixed-bam-fq.fofn
   $ echo $FASTQ >> $CRAMTMP/mixed-bam-fq.fofn
   $ $__PBTEST_PBMM2_EXE align $CRAMTMP/mixed-bam-fq.fofn $REF $CRAMTMP/mixed-bam-fq.bam
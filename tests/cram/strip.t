@@ -143,3 +143,7 @@ Internal BAM
   rq:f:0.8
   sn:B:f,15.5635,23.6604,5.38361,10.063
   zm:i:4325908
+
+Retained tags keep their order
+  $ samtools view $CRAMTMP/full_int.bam | head -n 1 | cut -f 12- | tr '\t' '\n' | cut -c 1-2 | grep -v -x -e dq -e dt -e ip -e iq -e mq -e pa -e pc -e pd -e pe -e pg -e pm -e pq -e pt -e pv -e pw -e px -e sf -e sq -e st > $CRAMTMP/full_int_tags.txt
+  $ samtools view $CRAMTMP/strip_int.bam | head -n 1 | cut -f 12- | tr '\t' '\n' | cut -c 1-2 | diff - $CRAMTMP/full_int_tags.txt
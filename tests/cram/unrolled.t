@@ -40,3 +40,6 @@
   *Run Time:* (glob)
   *CPU Time:* (glob)
   *Peak RSS:* (glob)
+
+  $ $__PBTEST_PBMM2_EXE align unrolled.json lambdaNEB_BsaAI_allFrags_incLeftRightEnds_unrolled_250k.fasta $CRAMTMP/zmw_single.bam --log-level INFO --zmw --chunk-size 1 2>&1| grep "Mapped Bases"
+  *Mapped Bases: 55704 (glob)
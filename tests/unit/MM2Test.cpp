@@ -126,6 +126,99 @@ TEST(MM2Test, FilterRead)
     EXPECT_EQ(85ul, alignedReads.size());
 }
 
+TEST(MM2Test, ThresholdsMatchFilterBAM)
+{
+    const auto refFile = tests::DataDir + '/' + "ecoliK12_pbi_March2013.fasta";
+    MM2Settings settings;
+    MM2Helper mm2helper(refFile, settings);
+    settings.Thresholds.MinSpan = 500;
+    settings.Thresholds.MinPercConcordance = 90;
+    MM2Helper thresholdHelper(refFile, settings);
+    const auto alnFile = tests::DataDir + '/' + "median.bam";
+    BAM::EntireFileQuery reader(alnFile);
+
+    const auto myFilter = [](const AlignedRecord& r) {
+        return r.Span >= 500 && r.Concordance >= 90;
+    };
+
+    int32_t numFiltered = 0;
+    for (const auto& record : reader) {
+        const auto filtered = mm2helper.Align(record, myFilter);
+        const auto thresholded = thresholdHelper.Align(record);
+        ASSERT_EQ(filtered.size(), thresholded.size());
+        for (size_t i = 0; i < filtered.size(); ++i) {
+            EXPECT_EQ(filtered[i].Record.ReferenceStart(), thresholded[i].Record.ReferenceStart());
+            EXPECT_EQ(filtered[i].Concordance, thresholded[i].Concordance);
+            ++numFiltered;
+        }
+    }
+    EXPECT_LT(0, numFiltered);
+}
+
+TEST(MM2Test, ReverseStrandMatchesPbbam)
+{
+    const auto refFile = tests::DataDir + '/' + "ecoliK12_pbi_March2013.fasta";
+    MM2Settings settings;
+    MM2Helper mm2helper(refFile, settings);
+    const auto alnFile = tests::DataDir + '/' + "median.bam";
+    BAM::EntireFileQuery reader(alnFile);
+    int32_t numReverse = 0;
+    for (const auto& record : reader) {
+        for (const auto& aln : mm2helper.Align(record)) {
+            if (!aln.IsAligned || aln.Record.AlignedStrand() != Data::Strand::REVERSE) continue;
+            ++numReverse;
+            const auto expected = BAM::BamRecord::Mapped(
+                record, aln.Record.ReferenceId(), aln.Record.ReferenceStart(),
+                Data::Strand::REVERSE, aln.Record.CigarData(), aln.Record.MapQuality());
+            EXPECT_EQ(expected.Impl().Sequence(), aln.Record.Impl().Sequence());
+            EXPECT_EQ(expected.Impl().Qualities().Fastq(), aln.Record.Impl().Qualities().Fastq());
+            EXPECT_EQ(record.Sequence(), aln.Record.Sequence(BAM::Orientation::NATIVE));
+            EXPECT_EQ(expected.AlignedStart(), aln.Record.AlignedStart());
+            EXPECT_EQ(expected.AlignedEnd(), aln.Record.AlignedEnd());
+        }
+    }
+    EXPECT_LT(0, numReverse);
+}
+
+TEST(MM2Test, FastxMatchesUnalignedBAM)
+{
+    const auto refFile = tests::DataDir + '/' + "ecoliK12_pbi_March2013.fasta";
+    MM2Settings settings;
+    MM2Helper mm2helper(refFile, settings);
+    settings.OutputUnmapped = true;
+    MM2Helper mm2helperUnmapped(refFile, settings);
+    const auto alnFile = tests::DataDir + '/' + "median.bam";
+    BAM::EntireFileQuery reader(alnFile);
+    auto tbuf = std::make_unique<ThreadBuffer>();
+    const auto noopFilter = [](const AlignedRecord&) { return true; };
+    int32_t numAligned = 0;
+    for (const auto& record : reader) {
+        const FastxRecord read{record.FullName(), record.Sequence(), record.Qualities().Fastq(),
+                               record.Header(), record.ReadGroupId()};
+        const auto expected = mm2helperUnmapped.Align(read.ToBam(), noopFilter, tbuf);
+        const auto alns = mm2helper.Align(read, noopFilter, tbuf);
+        if (expected.size() == 1 && !expected.front().IsAligned) {
+            EXPECT_TRUE(alns.empty());
+            EXPECT_TRUE(mm2helper.Align(read.ToBam(), noopFilter, tbuf).empty());
+            const auto unmapped = mm2helperUnmapped.Align(read, noopFilter, tbuf);
+            ASSERT_EQ(1ul, unmapped.size());
+            EXPECT_FALSE(unmapped.front().IsAligned);
+            EXPECT_EQ(read.Bases, unmapped.front().Record.Sequence());
+            continue;
+        }
+        ASSERT_EQ(expected.size(), alns.size());
+        for (size_t i = 0; i < alns.size(); ++i) {
+            ++numAligned;
+            EXPECT_EQ(expected[i].Record.ReferenceStart(), alns[i].Record.ReferenceStart());
+            EXPECT_EQ(expected[i].Record.CigarData().ToStdString(),
+                      alns[i].Record.CigarData().ToStdString());
+            EXPECT_EQ(expected[i].Record.Impl().Sequence(), alns[i].Record.Impl().Sequence());
+            EXPECT_EQ(expected[i].Record.QueryEnd(), alns[i].Record.QueryEnd());
+        }
+    }
+    EXPECT_LT(0, numAligned);
+}
+
 TEST(MM2Test, UseCommonThreadBuffer)
 {
     const auto refFile = tests::DataDir + '/' + "ecoliK12_pbi_March2013.fasta";
@@ -412,5 +505,60 @@ TEST(MM2Test, FastaRefAlignMoveRead)
     }
 }
 
+TEST(MM2Test, WindowedUnrolledAlign)
+{
+    const auto refFile = tests::DataDir + '/' + "ecoliK12_pbi_March2013.fasta";
+    MM2Settings settings;
+    settings.AlignMode = AlignmentMode::UNROLLED;
+    settings.WindowSize = 1000;
+    MM2Helper mm2helper(refFile, settings);
+    const auto alnFile = tests::DataDir + '/' + "median.bam";
+    BAM::EntireFileQuery reader(alnFile);
+    const FilterFunc noopFilter = [](const AlignedRecord&) { return true; };
+    std::unique_ptr<ThreadBuffer> tbuf;
+    int32_t numWindowed = 0;
+    for (const auto& record : reader) {
+        const std::string seq = record.Sequence();
+        const int32_t qlen = seq.size();
+        const auto windows = mm2helper.SplitIntoWindows(qlen);
+        if (qlen < 2 * settings.WindowSize) {
+            EXPECT_TRUE(windows.empty());
+            continue;
+        }
+        ++numWindowed;
+        ASSERT_LT(1ul, windows.size());
+        EXPECT_EQ(0, windows.front().Begin);
+        EXPECT_EQ(qlen, windows.back().End);
+        for (size_t i = 0; i < windows.size(); ++i) {
+            EXPECT_GE(settings.WindowSize, windows[i].End - windows[i].Begin);
+            if (i > 0) EXPECT_LT(windows[i].Begin, windows[i - 1].End);
+        }
+
+        std::vector<WindowHit> hits;
+        for (const auto& window : windows)
+            hits.emplace_back(mm2helper.MapWindow(seq, window, tbuf));
+        const auto stitched = mm2helper.StitchWindows(record, windows, hits, noopFilter, tbuf);
+        const auto whole = mm2helper.Align(record, noopFilter, tbuf);
+        if (whole.empty() || !whole.front().IsAligned) continue;
+
+        ASSERT_EQ(1ul, stitched.size());
+        const auto& fromWindows = stitched.front().Record;
+        const auto& fromWhole = whole.front().Record;
+        EXPECT_TRUE(stitched.front().IsAligned);
+        EXPECT_EQ(fromWhole.FullName(), fromWindows.FullName());
+        EXPECT_EQ(fromWhole.Sequence(), fromWindows.Sequence());
+        EXPECT_EQ(fromWhole.ReferenceId(), fromWindows.ReferenceId());
+        EXPECT_EQ(fromWhole.AlignedStrand(), fromWindows.AlignedStrand());
+        EXPECT_LT(fromWindows.ReferenceStart(), fromWhole.ReferenceEnd());
+        EXPECT_GT(fromWindows.ReferenceEnd(), fromWhole.ReferenceStart());
+
+        int32_t cigarQueryLength = 0;
+        for (const auto& op : fromWindows.CigarData())
+            if (Data::ConsumesQuery(op.Type())) cigarQueryLength += op.Length();
+        EXPECT_EQ(qlen, cigarQueryLength);
+    }
+    EXPECT_LT(0, numWindowed);
+}
+
 }  // namespace MM2Tests
 }  // namespace PacBio
@@ -50,6 +50,7 @@ DEALINGS IN THE SOFTWARE.  */
 #include <sys/stat.h>
 #include <time.h>
 #include <unistd.h>
+#include "htslib/bgzf.h"
 #include "htslib/khash.h"
 #include "htslib/klist.h"
 #include "htslib/ksort.h"
@@ -1192,13 +1193,14 @@ int *rtrans_build(int n, int n_targets, trans_tbl_t *translation_tbl)
   @param  cmd         command name (used in print_error() etc)
   @param  in_fmt      format options for input files
   @param  out_fmt     output file format and options
+  @param  output      if non-null, index and record callback of the output
   @discussion Padding information may NOT correctly maintained. This
   function is NOT thread safe.
  */
 int bam_merge_core2(int by_qname, char *sort_tag, const char *out, const char *mode,
                     const char *headers, int n, char *const *fn, int flag, const char *reg,
                     int n_threads, const char *cmd, const htsFormat *in_fmt,
-                    const htsFormat *out_fmt)
+                    const htsFormat *out_fmt, bam_merge_output_t *output)
 {
     samFile *fpout, **fp = NULL;
     heap1_t *heap = NULL;
@@ -1454,12 +1456,32 @@ int bam_merge_core2(int by_qname, char *sort_tag, const char *out, const char *m
         print_error_errno(cmd, "failed to create \"%s\"", out);
         return -1;
     }
+    if (output && output->gzi_name && bgzf_index_build_init(fpout->fp.bgzf) < 0) {
+        print_error(cmd, "failed to track blocks of \"%s\"", out);
+        sam_close(fpout);
+        return -1;
+    }
     if (sam_hdr_write(fpout, hout) != 0) {
         print_error_errno(cmd, "failed to write header to \"%s\"", out);
         sam_close(fpout);
         return -1;
     }
+    if (output) {
+        // records start in a new block, its offset is exact before threads are attached
+        if (bgzf_flush(fpout->fp.bgzf) < 0) {
+            print_error_errno(cmd, "failed to write header to \"%s\"", out);
+            sam_close(fpout);
+            return -1;
+        }
+        output->first_block = bgzf_tell(fpout->fp.bgzf) >> 16;
+    }
     if (!(flag & MERGE_UNCOMP)) hts_set_threads(fpout, n_threads);
+    if (output && output->index_min_shift >= 0 &&
+        sam_idx_init(fpout, hout, output->index_min_shift, output->index_name) < 0) {
+        print_error(cmd, "failed to initialise index for \"%s\"", out);
+        sam_close(fpout);
+        return -1;
+    }
 
     // Begin the actual merge
     ks_heapmake(bam_sort_heap, n, heap);
@@ -1470,11 +1492,12 @@ int bam_merge_core2(int by_qname, char *sort_tag, const char *out, const char *m
             if (rg) bam_aux_del(b, rg);
             bam_aux_append(b, "RG", 'Z', RG_len[heap->i] + 1, (uint8_t *)RG[heap->i]);
         }
-        if (sam_write1(fpout, hout, b) < 0) {
+        if ((j = sam_write1(fpout, hout, b)) < 0) {
             print_error_errno(cmd, "failed writing to \"%s\"", out);
             sam_close(fpout);
             return -1;
         }
+        if (output && output->on_record) output->on_record(output->on_record_data, heap->i, b, j);
         if ((j = (iter[heap->i] ? sam_itr_next(fp[heap->i], iter[heap->i], b)
                                 : sam_read1(fp[heap->i], hdr[heap->i], b))) >= 0) {
             bam_translate(b, translation_tbl + heap->i);
@@ -1519,6 +1542,18 @@ int bam_merge_core2(int by_qname, char *sort_tag, const char *out, const char *m
     free(heap);
     free(iter);
     free(hdr);
+    if (output && output->index_min_shift >= 0 && sam_idx_save(fpout) < 0) {
+        print_error_errno(cmd, "writing index for \"%s\" failed", out);
+        sam_close(fpout);
+        return -1;
+    }
+    if (output && output->gzi_name &&
+        (bgzf_flush(fpout->fp.bgzf) < 0 ||
+         bgzf_index_dump(fpout->fp.bgzf, output->gzi_name, NULL) < 0)) {
+        print_error_errno(cmd, "writing block offsets of \"%s\" failed", out);
+        sam_close(fpout);
+        return -1;
+    }
     if (sam_close(fpout) < 0) {
         print_error(cmd, "error closing output file");
         return -1;
@@ -1565,7 +1600,13 @@ int bam_merge_core(int by_qname, const char *out, const char *headers, int n, ch
     else if (flag & MERGE_LEVEL1)
         strcat(mode, "1");
     return bam_merge_core2(by_qname, NULL, out, mode, headers, n, fn, flag, reg, 0, "merge", NULL,
-                           NULL);
+                           NULL, NULL);
+}
+
+int bam_merge(const char *out, int n, char *const *fn, int n_threads, bam_merge_output_t *output)
+{
+    return bam_merge_core2(0, NULL, out, "wb", NULL, n, fn, MERGE_COMBINE_RG | MERGE_COMBINE_PG,
+                           NULL, n_threads, "merge", NULL, NULL, output);
 }
 
 /***************
@@ -2,6 +2,10 @@
 
 #pragma once
 
+#include <stdint.h>
+
+#include <htslib/sam.h>
+
 #ifdef __cplusplus
 extern "C"
 {
@@ -10,6 +14,25 @@ extern "C"
     int bam_sort(const char *inputName, const char *outputName, const char *tmpDir, bool useTmpDir,
                  int numThreads, int merge_threads, size_t memory, int *numFiles, int *numBlocks);
 
+    /* Called after each merged record has been written, with the index of the
+       input it was read from and its size in the uncompressed BAM stream */
+    typedef void (*bam_merge_record_fn)(void *data, int input, const bam1_t *b, int64_t length);
+
+    typedef struct
+    {
+        int index_min_shift;    /* 0 for BAI, 14 for CSI, -1 without index */
+        const char *index_name; /* BAI or CSI file, built while writing */
+        const char *gzi_name;   /* if set, offsets of all BGZF blocks are written to it */
+        int64_t first_block;    /* set to the file offset of the first block after the header */
+        bam_merge_record_fn on_record;
+        void *on_record_data;
+    } bam_merge_output_t;
+
+    /* Merges coordinate-sorted BAM files, read groups and programs with the
+       same ID are combined. Returns 0 on success. */
+    int bam_merge(const char *out, int n, char *const *fn, int n_threads,
+                  bam_merge_output_t *output);
+
 #ifdef __cplusplus
 }
 #endif